@@ -4,6 +4,7 @@
 #include <cstdint>
 #include <string>
 #include <vector>
+#include <climits>
 
 // Forward declarations
 class Position;
@@ -125,11 +126,22 @@ struct ChessWizardOptions {
     uint8_t multi_pv;
     double resign_threshold;
     uint64_t seed;
+    // Fields added after the first release go last so existing C callers
+    // keep their layout
+    uint32_t threads; // search threads (Lazy SMP), 0 is treated as 1
 };
 
 struct SearchLimits {
-    int movetime; // max time in ms
-    int max_depth; // max search depth
+    int movetime = INT_MAX; // fixed time per move in ms
+    int max_depth = MAX_PLY - 1; // max search depth
+    bool infinite = false; // ignore the clock and search until stopped
+    // Game clock in ms; when the side to move has time left the time manager
+    // budgets the move from these instead of using movetime alone
+    int wtime = 0;
+    int btime = 0;
+    int winc = 0;
+    int binc = 0;
+    int movestogo = 0; // 0 = sudden death
 };
 
 // File and Rank representation
@@ -6,17 +6,26 @@
 Bitboard PAWN_ATTACKS[2][64];
 Bitboard KNIGHT_ATTACKS[64];
 Bitboard KING_ATTACKS[64];
-Bitboard BISHOP_ATTACKS[64];
-Bitboard ROOK_ATTACKS[64];
+Bitboard BETWEEN_BB[64][64];
+Bitboard LINE_BB[64][64];
 
-// --- Magic Bitboard Tables (placeholder) ---
+// --- Magic Bitboard Tables ---
+Magic BISHOP_MAGICS[64];
+Magic ROOK_MAGICS[64];
+bool USE_PEXT = false;
+
+// Sizes of the shared tables: sum over squares of 2^popcount(mask)
+static Bitboard BISHOP_TABLE[0x1480];
+static Bitboard ROOK_TABLE[0x19000];
 
 Bitboard mask_pawn_attacks(Color side, Square sq) {
     Bitboard attacks = 0;
     if (side == WHITE) {
+        if (sq >= 56) return attacks; // No squares ahead of the last rank
         if ((sq % 8) != 0) attacks |= (1ULL << (sq + 7));
         if ((sq % 8) != 7) attacks |= (1ULL << (sq + 9));
     } else {
+        if (sq < 8) return attacks;
         if ((sq % 8) != 0) attacks |= (1ULL << (sq - 9));
         if ((sq % 8) != 7) attacks |= (1ULL << (sq - 7));
     }
@@ -52,8 +61,9 @@ Bitboard mask_king_attacks(Square sq) {
 }
 
 // --- Blocker-based sliding piece attack generation ---
+// Slow ray walkers, only used to fill the magic tables.
 
-Bitboard get_bishop_attacks(Square sq, Bitboard blockers) {
+static Bitboard bishop_attacks_on_the_fly(Square sq, Bitboard blockers) {
     Bitboard attacks = 0;
     int r, f;
     int tr = sq / 8;
@@ -86,7 +96,7 @@ Bitboard get_bishop_attacks(Square sq, Bitboard blockers) {
     return attacks;
 }
 
-Bitboard get_rook_attacks(Square sq, Bitboard blockers) {
+static Bitboard rook_attacks_on_the_fly(Square sq, Bitboard blockers) {
     Bitboard attacks = 0;
     int r, f;
     int tr = sq / 8;
@@ -126,12 +136,93 @@ Bitboard get_piece_attacks(PieceType pt, Square sq, Bitboard blockers) {
         case WN: case BN: return KNIGHT_ATTACKS[sq];
         case WB: case BB: return get_bishop_attacks(sq, blockers);
         case WR: case BR: return get_rook_attacks(sq, blockers);
-        case WQ: case BQ: return get_bishop_attacks(sq, blockers) | get_rook_attacks(sq, blockers);
+        case WQ: case BQ: return get_queen_attacks(sq, blockers);
         case WK: case BK: return KING_ATTACKS[sq];
         default: return 0;
     }
 }
 
+// --- Magic Number Search ---
+
+// xorshift64* generator used to find magics; sparse_rand() returns numbers
+// with few set bits, which are much more likely to be good magics.
+struct MagicRNG {
+    uint64_t state;
+
+    explicit MagicRNG(uint64_t seed) : state(seed) {}
+
+    uint64_t rand() {
+        state ^= state >> 12;
+        state ^= state << 25;
+        state ^= state >> 27;
+        return state * 2685821657736338717ULL;
+    }
+
+    uint64_t sparse_rand() { return rand() & rand() & rand(); }
+};
+
+// Per-rank seeds that find a working magic for every square quickly
+static const uint64_t MAGIC_SEEDS[8] = {728, 10316, 55013, 32803, 12281, 15100, 16645, 255};
+
+static void init_magics(Bitboard table[], Magic magics[], Bitboard (*slider_attacks)(Square, Bitboard)) {
+    const Bitboard RANK_1_BB = 0xFFULL;
+    const Bitboard RANK_8_BB = RANK_1_BB << 56;
+
+    static Bitboard occupancy[4096];
+    static Bitboard reference[4096];
+    static int epoch[4096];
+    int attempt = 0;
+    int size = 0;
+
+    for (int s = 0; s < 64; ++s) {
+        Square sq = (Square)s;
+        Magic& m = magics[s];
+
+        // Board edges are not relevant unless the slider stands on them
+        Bitboard edges = ((RANK_1_BB | RANK_8_BB) & ~(RANK_1_BB << (8 * rank_of(sq))))
+                       | ((FILE_A_BB | FILE_H_BB) & ~(FILE_A_BB << file_of(sq)));
+
+        m.mask = slider_attacks(sq, 0) & ~edges;
+        m.shift = 64 - popcnt(m.mask);
+        m.magic = 0;
+        m.attacks = (s == 0) ? table : magics[s - 1].attacks + size;
+
+        // Enumerate every subset of the mask (Carry-Rippler) and record the
+        // reference attacks for it
+        Bitboard b = 0;
+        size = 0;
+        do {
+            occupancy[size] = b;
+            reference[size] = slider_attacks(sq, b);
+            if (USE_PEXT) {
+                m.attacks[pext(b, m.mask)] = reference[size];
+            }
+            size++;
+            b = (b - m.mask) & m.mask;
+        } while (b);
+
+        if (USE_PEXT) continue;
+
+        // Try random sparse candidates until one maps every subset without
+        // a destructive collision
+        MagicRNG rng(MAGIC_SEEDS[rank_of(sq)]);
+        for (int i = 0; i < size;) {
+            for (m.magic = 0; popcnt((m.magic * m.mask) >> 56) < 6;) {
+                m.magic = rng.sparse_rand();
+            }
+
+            for (++attempt, i = 0; i < size; ++i) {
+                unsigned idx = m.index(occupancy[i]);
+                if (epoch[idx] < attempt) {
+                    epoch[idx] = attempt;
+                    m.attacks[idx] = reference[i];
+                } else if (m.attacks[idx] != reference[i]) {
+                    break;
+                }
+            }
+        }
+    }
+}
 
 void init_attacks() {
     for (int sq = 0; sq < 64; ++sq) {
@@ -140,6 +231,28 @@ void init_attacks() {
         KNIGHT_ATTACKS[sq] = mask_knight_attacks((Square)sq);
         KING_ATTACKS[sq] = mask_king_attacks((Square)sq);
     }
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+    USE_PEXT = __builtin_cpu_supports("bmi2");
+#endif
+
+    init_magics(BISHOP_TABLE, BISHOP_MAGICS, bishop_attacks_on_the_fly);
+    init_magics(ROOK_TABLE, ROOK_MAGICS, rook_attacks_on_the_fly);
+
+    for (int s1 = 0; s1 < 64; ++s1) {
+        for (int s2 = 0; s2 < 64; ++s2) {
+            Bitboard b1 = 1ULL << s1, b2 = 1ULL << s2;
+            BETWEEN_BB[s1][s2] = LINE_BB[s1][s2] = 0;
+            if (s1 == s2) continue;
+            if (get_bishop_attacks((Square)s1, 0) & b2) {
+                BETWEEN_BB[s1][s2] = get_bishop_attacks((Square)s1, b2) & get_bishop_attacks((Square)s2, b1);
+                LINE_BB[s1][s2] = (get_bishop_attacks((Square)s1, 0) & get_bishop_attacks((Square)s2, 0)) | b1 | b2;
+            } else if (get_rook_attacks((Square)s1, 0) & b2) {
+                BETWEEN_BB[s1][s2] = get_rook_attacks((Square)s1, b2) & get_rook_attacks((Square)s2, b1);
+                LINE_BB[s1][s2] = (get_rook_attacks((Square)s1, 0) & get_rook_attacks((Square)s2, 0)) | b1 | b2;
+            }
+        }
+    }
 }
 
 // Piece values for SEE (centipawns)
@@ -156,68 +269,49 @@ int see(const Position& pos, Move move) {
     Bitboard may_xray = pos.piece_bitboards[WB] | pos.piece_bitboards[BB] | pos.piece_bitboards[WR] | pos.piece_bitboards[BR] | pos.piece_bitboards[WQ] | pos.piece_bitboards[BQ];
     Bitboard from_bb = 1ULL << from;
     Bitboard occ = pos.occupancy_bitboards[BOTH];
-    Bitboard attackers = 0;
 
     // Initial capture
     gain[d] = SEE_VALUES[captured];
     d++;
 
-    // Find all attackers
-    attackers |= (PAWN_ATTACKS[WHITE][to] & pos.piece_bitboards[BP]) | (PAWN_ATTACKS[BLACK][to] & pos.piece_bitboards[WP]);
-    attackers |= (KNIGHT_ATTACKS[to] & (pos.piece_bitboards[WN] | pos.piece_bitboards[BN]));
-    attackers |= (KING_ATTACKS[to] & (pos.piece_bitboards[WK] | pos.piece_bitboards[BK]));
-
-    Bitboard bishops = pos.piece_bitboards[WB] | pos.piece_bitboards[BB];
-    Bitboard rooks = pos.piece_bitboards[WR] | pos.piece_bitboards[BR];
-    Bitboard queens = pos.piece_bitboards[WQ] | pos.piece_bitboards[BQ];
-
-    if (bishops | queens) attackers |= get_bishop_attacks(to, occ) & (bishops | queens);
-    if (rooks | queens) attackers |= get_rook_attacks(to, occ) & (rooks | queens);
-
-    // Remove the moving piece if it's still on from (but since we're simulating, assume it's moved)
-    attackers &= ~from_bb;
-
-    Color side = (moving >= BP) ? BLACK : WHITE;
-
     occ ^= from_bb; // Remove moving piece
     if (captured != NO_PIECE) occ ^= (1ULL << to); // Remove captured piece
 
-    while (attackers) {
-        // Find least valuable attacker
+    // With the mover gone, sliders behind it already see the target
+    Bitboard attackers = pos.attackers_to(to, occ) & occ;
+
+    // The opponent recaptures first
+    Color side = (moving >= BP) ? WHITE : BLACK;
+    PieceType last = moving;
+
+    while (true) {
+        // Find the least valuable attacker of the side to capture
+        int first = (side == WHITE) ? WP : BP;
         PieceType pt = NO_PIECE;
         Bitboard attacker_bb = 0;
-        int min_value = 10000;
-
-        for (int p = WP; p <= BK; ++p) {
+        for (int p = first; p < first + 6; ++p) {
             Bitboard bb = attackers & pos.piece_bitboards[p];
             if (bb) {
-                int val = SEE_VALUES[p];
-                if (val < min_value) {
-                    min_value = val;
-                    pt = (PieceType)p;
-                    attacker_bb = bb & -bb; // LSB
-                }
+                pt = (PieceType)p;
+                attacker_bb = bb & -bb; // LSB
+                break;
             }
         }
 
         if (pt == NO_PIECE) break;
 
-        // Add capture value
-        gain[d] = SEE_VALUES[pt] - gain[d - 1];
+        // Capture the piece that took last
+        gain[d] = SEE_VALUES[last] - gain[d - 1];
         d++;
+        last = pt;
 
         // Update occupancy
         occ ^= attacker_bb;
 
         // Add discovered attacks
         if (may_xray & attacker_bb) {
-            Bitboard xray_attackers = 0;
-            if (bishops | queens) xray_attackers |= get_bishop_attacks(to, occ) & (bishops | queens);
-            if (rooks | queens) xray_attackers |= get_rook_attacks(to, occ) & (rooks | queens);
-            attackers |= xray_attackers;
+            attackers |= pos.attackers_to(to, occ) & may_xray;
         }
-
-        attackers &= ~attacker_bb;
         attackers &= occ; // Only pieces still on board
 
         side = (side == WHITE) ? BLACK : WHITE;
@@ -3,6 +3,10 @@
 
 #include "bitboard.h"
 
+#if defined(__BMI2__)
+#include <immintrin.h>
+#endif
+
 // Forward declaration
 class Position;
 
@@ -11,21 +15,78 @@ extern Bitboard PAWN_ATTACKS[2][64];
 extern Bitboard KNIGHT_ATTACKS[64];
 extern Bitboard KING_ATTACKS[64];
 
+// Squares strictly between two aligned squares, and the full board line
+// through them (both empty when the squares share no rank, file or diagonal)
+extern Bitboard BETWEEN_BB[64][64];
+extern Bitboard LINE_BB[64][64];
+
 // --- File & Rank Masks (for attack generation) ---
 const Bitboard FILE_A_BB = 0x0101010101010101ULL;
 const Bitboard FILE_H_BB = 0x8080808080808080ULL;
 const Bitboard FILE_AB_BB = FILE_A_BB | (FILE_A_BB << 1);
 const Bitboard FILE_GH_BB = FILE_H_BB | (FILE_H_BB >> 1);
 
+// --- Magic Bitboards ---
+// Fancy magic tables for sliding pieces. Each square owns a slice of a shared
+// attack table, indexed either by the magic multiply or, when the CPU supports
+// BMI2, by PEXT. The indexing scheme is chosen once in init_attacks().
+struct Magic {
+    Bitboard mask;     // Relevant occupancy (board edges excluded)
+    Bitboard magic;    // Magic multiplier (unused in PEXT mode)
+    Bitboard* attacks; // Start of this square's slice of the attack table
+    unsigned shift;    // 64 - popcount(mask)
+
+    unsigned index(Bitboard blockers) const;
+};
+
+extern Magic BISHOP_MAGICS[64];
+extern Magic ROOK_MAGICS[64];
+extern bool USE_PEXT;
+
+// Parallel bit extract. Only called when USE_PEXT is set, so the inline asm
+// fallback lets a non-BMI2 build still use PEXT on a BMI2 machine.
+inline Bitboard pext(Bitboard src, Bitboard mask) {
+#if defined(__BMI2__)
+    return _pext_u64(src, mask);
+#elif defined(__x86_64__)
+    Bitboard result;
+    __asm__("pextq %2, %1, %0" : "=r"(result) : "r"(src), "r"(mask));
+    return result;
+#else
+    (void)src;
+    (void)mask;
+    return 0;
+#endif
+}
+
+inline unsigned Magic::index(Bitboard blockers) const {
+    if (USE_PEXT) {
+        return static_cast<unsigned>(pext(blockers, mask));
+    }
+    return static_cast<unsigned>(((blockers & mask) * magic) >> shift);
+}
+
 // --- Initialization Function ---
 void init_attacks();
 
-// --- On-the-fly Attack Getters ---
+// --- Attack Getters ---
 Bitboard get_piece_attacks(PieceType pt, Square sq, Bitboard blockers);
 
-// Sliding piece attack getters
-Bitboard get_bishop_attacks(Square sq, Bitboard blockers);
-Bitboard get_rook_attacks(Square sq, Bitboard blockers);
+// Sliding piece attack getters (table lookups, valid after init_attacks())
+inline Bitboard get_bishop_attacks(Square sq, Bitboard blockers) {
+    const Magic& m = BISHOP_MAGICS[sq];
+    return m.attacks[m.index(blockers)];
+}
+
+inline Bitboard get_rook_attacks(Square sq, Bitboard blockers) {
+    const Magic& m = ROOK_MAGICS[sq];
+    return m.attacks[m.index(blockers)];
+}
+
+inline Bitboard get_queen_attacks(Square sq, Bitboard blockers) {
+    return get_bishop_attacks(sq, blockers) | get_rook_attacks(sq, blockers);
+}
+
 // --- Static Exchange Evaluation ---
 
 // Piece values for SEE (centipawns)
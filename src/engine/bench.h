@@ -0,0 +1,25 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include "types.h"
+#include <cstdint>
+#include <string>
+
+// Default search depth for the bench suite
+const int BENCH_DEPTH = 8;
+
+struct BenchOptions {
+    int depth = BENCH_DEPTH;
+    uint32_t tt_size_mb = 32;
+    uint32_t threads = 1;
+    bool json = false;
+    std::string fen; // Search only this position instead of the suite
+};
+
+// Search every position of the built-in suite to a fixed depth with a cleared
+// TT and print per-position results followed by total nodes and NPS. With one
+// thread the total node count is deterministic and serves as the signature of
+// the build. Returns the total node count.
+uint64_t run_bench(const BenchOptions& bench_opts, const ChessWizardOptions& opts);
+
+#endif // BENCH_H
@@ -3,9 +3,11 @@
 #include "attack.h"
 #include "bitboard.h"
 #include "move.h"
+#include "evaluate.h"
 #include <iostream>
 #include <sstream>
 #include <cctype>
+#include <algorithm>
 
 
 
@@ -21,7 +23,37 @@ Position::Position() {
     halfmove_clock = 0;
     fullmove_number = 1;
     hash_key = 0;
+    checkers = 0;
+    psq_mg = 0;
+    psq_eg = 0;
+    phase = 0;
+    pawn_key = 0;
+    book_key = 0;
     history_size = 0;
+    std::fill(std::begin(piece_of_square), std::end(piece_of_square), (uint8_t)NO_PIECE);
+}
+
+Position::Position(StateStack& stack) : Position() {
+    states = &stack;
+}
+
+void Position::set_state_stack(StateStack& stack) {
+    if (states && states != &stack) {
+        for (size_t i = 0; i < history_size; ++i) {
+            stack.put(i, (*states)[i]);
+        }
+    }
+    states = &stack;
+}
+
+// Polyglot counts the en passant square only when a pawn of the side to
+// move stands next to the pawn that just advanced two squares
+static uint64_t polyglot_ep_key(const Position& pos) {
+    if (pos.en_passant_sq == NO_SQUARE) return 0;
+    Color them = (pos.side_to_move == WHITE) ? BLACK : WHITE;
+    Bitboard our_pawns = pos.piece_bitboards[pos.side_to_move == WHITE ? WP : BP];
+    if (!(PAWN_ATTACKS[them][pos.en_passant_sq] & our_pawns)) return 0;
+    return Polyglot.en_passant_keys[file_of(pos.en_passant_sq)];
 }
 
 void Position::set_from_fen(const std::string& fen) {
@@ -30,7 +62,13 @@ void Position::set_from_fen(const std::string& fen) {
     occupancy_bitboards[0] = 0;
     occupancy_bitboards[1] = 0;
     occupancy_bitboards[2] = 0;
+    psq_mg = 0;
+    psq_eg = 0;
+    phase = 0;
+    pawn_key = 0;
+    book_key = 0;
     history_size = 0;
+    std::fill(std::begin(piece_of_square), std::end(piece_of_square), (uint8_t)NO_PIECE);
 
     std::istringstream iss(fen);
     std::string board_str, side_str, castle_str, ep_str, hm_str, fm_str;
@@ -59,6 +97,8 @@ void Position::set_from_fen(const std::string& fen) {
             set_bit(piece_bitboards[pt], (Square)sq);
             set_bit(occupancy_bitboards[color], (Square)sq);
             set_bit(occupancy_bitboards[BOTH], (Square)sq);
+            piece_of_square[sq] = pt;
+            add_piece_terms(pt, (Square)sq);
             sq++;
         }
     }
@@ -80,11 +120,6 @@ void Position::set_from_fen(const std::string& fen) {
     halfmove_clock = std::stoi(hm_str);
     fullmove_number = std::stoi(fm_str);
 
-    // Initialize piece_of_square
-    for (int sq = 0; sq < 64; ++sq) {
-        piece_of_square[sq] = piece_on_square((Square)sq);
-    }
-
     // Compute hash
     hash_key = 0;
     for (int sq = 0; sq < 64; ++sq) {
@@ -101,62 +136,72 @@ void Position::set_from_fen(const std::string& fen) {
         int file = en_passant_sq % 8;
         hash_key ^= Zobrist.en_passant_keys[file];
     }
+    if (side_to_move == WHITE) {
+        book_key ^= Polyglot.side_to_move_key;
+    }
+    book_key ^= Polyglot.castling_keys[castling_rights];
+    book_key ^= polyglot_ep_key(*this);
+
+    Color them = (side_to_move == WHITE) ? BLACK : WHITE;
+    checkers = attackers_to(get_king_square(*this, side_to_move), occupancy_bitboards[BOTH]) & occupancy_bitboards[them];
 }
 
 PieceType Position::piece_on_square(Square sq) const {
-    for (int i = 0; i < 12; ++i) {
-        if (piece_bitboards[i] & (1ULL << sq)) {
-            return (PieceType)i;
-        }
-    }
-    return NO_PIECE;
+    return (PieceType)piece_of_square[sq];
 }
 
-bool Position::is_square_attacked(Square sq, Color by_color) const {
-    // Check pawns
-    Bitboard pawns = piece_bitboards[by_color == WHITE ? WP : BP];
-    Bitboard pawn_attacks = by_color == WHITE ? ((pawns & ~FILE_H) << 7) | ((pawns & ~FILE_A) << 9) : ((pawns & ~FILE_H) >> 9) | ((pawns & ~FILE_A) >> 7);
-    if (pawn_attacks & (1ULL << sq)) return true;
-
-    // Check knights
-    Bitboard knights = piece_bitboards[by_color == WHITE ? WN : BN];
-    while (knights) {
-        Square from = pop_bit(knights);
-        if (KNIGHT_ATTACKS[from] & (1ULL << sq)) return true;
-    }
+Bitboard Position::attackers_to(Square sq, Bitboard occupied) const {
+    Bitboard bishops_queens = piece_bitboards[WB] | piece_bitboards[BB] | piece_bitboards[WQ] | piece_bitboards[BQ];
+    Bitboard rooks_queens = piece_bitboards[WR] | piece_bitboards[BR] | piece_bitboards[WQ] | piece_bitboards[BQ];
+    return (PAWN_ATTACKS[BLACK][sq] & piece_bitboards[WP])
+         | (PAWN_ATTACKS[WHITE][sq] & piece_bitboards[BP])
+         | (KNIGHT_ATTACKS[sq] & (piece_bitboards[WN] | piece_bitboards[BN]))
+         | (KING_ATTACKS[sq] & (piece_bitboards[WK] | piece_bitboards[BK]))
+         | (get_bishop_attacks(sq, occupied) & bishops_queens)
+         | (get_rook_attacks(sq, occupied) & rooks_queens);
+}
 
-    // Check bishops/queens
-    Bitboard bishops = piece_bitboards[by_color == WHITE ? WB : BB] | piece_bitboards[by_color == WHITE ? WQ : BQ];
-    while (bishops) {
-        Square from = pop_bit(bishops);
-        Bitboard attacks = get_bishop_attacks(from, occupancy_bitboards[BOTH]);
-        attacks &= ~occupancy_bitboards[by_color];
-        if (attacks & (1ULL << sq)) return true;
-    }
+bool Position::is_square_attacked(Square sq, Color by_color) const {
+    return (attackers_to(sq, occupancy_bitboards[BOTH]) & occupancy_bitboards[by_color]) != 0;
+}
 
-    // Check rooks/queens
-    Bitboard rooks = piece_bitboards[by_color == WHITE ? WR : BR] | piece_bitboards[by_color == WHITE ? WQ : BQ];
-    while (rooks) {
-        Square from = pop_bit(rooks);
-        Bitboard attacks = get_rook_attacks(from, occupancy_bitboards[BOTH]);
-        attacks &= ~occupancy_bitboards[by_color];
-        if (attacks & (1ULL << sq)) return true;
-    }
+bool Position::is_check() const {
+    return checkers != 0;
+}
 
-    // Check king
-    Bitboard king = piece_bitboards[by_color == WHITE ? WK : BK];
-    if (king) {
-        Square from = (Square)lsb_index(king);
-        Bitboard attacks = KING_ATTACKS[from];
-        if (attacks & (1ULL << sq)) return true;
-    }
+void Position::add_piece_terms(int pt, Square sq) {
+    psq_mg += PSQ_MG[pt][sq];
+    psq_eg += PSQ_EG[pt][sq];
+    phase += PIECE_PHASE[pt];
+    if (pt == WP || pt == BP) pawn_key ^= Zobrist.piece_keys[pt][sq];
+    book_key ^= Polyglot.piece_keys[pt][sq];
+}
 
-    return false;
+void Position::remove_piece_terms(int pt, Square sq) {
+    psq_mg -= PSQ_MG[pt][sq];
+    psq_eg -= PSQ_EG[pt][sq];
+    phase -= PIECE_PHASE[pt];
+    if (pt == WP || pt == BP) pawn_key ^= Zobrist.piece_keys[pt][sq];
+    book_key ^= Polyglot.piece_keys[pt][sq];
 }
 
-bool Position::is_check() const {
-    Square king_sq = get_king_square(*this, side_to_move);
-    return is_square_attacked(king_sq, (Color)(1 - side_to_move));
+// Every StateInfo records the hash from before its move, so the history stack
+// doubles as the list of earlier positions. Only positions with the same side
+// to move can match, and nothing before a pawn move, capture or null move can.
+// A repetition inside the search tree is scored as a draw at once; one that
+// reaches back into the game history must be the position's third occurrence.
+bool Position::is_repetition(int ply) const {
+    int end = std::min<int>(halfmove_clock, (int)history_size);
+    int occurrences = 0;
+    for (int i = 1; i <= end; ++i) {
+        const StateInfo& si = (*states)[history_size - i];
+        if (si.from == NO_SQUARE) break; // Null move
+        if (i >= 4 && (i & 1) == 0 && si.prev_zobrist == hash_key) {
+            if (i <= ply) return true;
+            if (++occurrences == 2) return true;
+        }
+    }
+    return false;
 }
 
 Square get_king_square(const Position& pos, Color color) {
@@ -203,9 +248,17 @@ bool Position::make_move(Move move) {
     si.prev_ep_file = en_passant_sq == NO_SQUARE ? -1 : file_of(en_passant_sq);
     si.prev_halfmove = halfmove_clock;
     si.prev_zobrist = hash_key;
-    si.eval_delta = 0; // TODO: compute incremental eval delta
+    si.prev_psq_mg = psq_mg;
+    si.prev_psq_eg = psq_eg;
+    si.prev_phase = phase;
     si.nnue_delta_count = 0; // TODO: nnue deltas
-    history[history_size++] = si;
+    si.prev_checkers = checkers;
+    si.prev_pawn_key = pawn_key;
+    si.prev_book_key = book_key;
+    states->put(history_size++, si);
+
+    // The old en passant key depends on pawns that may be about to move
+    book_key ^= polyglot_ep_key(*this);
 
     // Update halfmove clock (reset on pawn move or capture)
     if (piece_moved == WP || piece_moved == BP || captured_piece != NO_PIECE || (flags & Move::EN_PASSANT)) {
@@ -218,19 +271,23 @@ bool Position::make_move(Move move) {
     clear_bit(piece_bitboards[piece_moved], from_sq);
     clear_bit(occupancy_bitboards[side_to_move], from_sq);
     clear_bit(occupancy_bitboards[BOTH], from_sq);
+    piece_of_square[from_sq] = NO_PIECE;
     hash_key ^= Zobrist.piece_keys[piece_moved][from_sq];
+    remove_piece_terms(piece_moved, from_sq);
 
     if (captured_piece != NO_PIECE && !(flags & Move::EN_PASSANT)) {
         clear_bit(piece_bitboards[captured_piece], to_sq);
         clear_bit(occupancy_bitboards[(side_to_move == WHITE ? BLACK : WHITE)], to_sq);
         clear_bit(occupancy_bitboards[BOTH], to_sq);
         hash_key ^= Zobrist.piece_keys[captured_piece][to_sq];
+        remove_piece_terms(captured_piece, to_sq);
     }
 
     // Place piece on 'to' square
     set_bit(piece_bitboards[piece_moved], to_sq);
     set_bit(occupancy_bitboards[side_to_move], to_sq);
     set_bit(occupancy_bitboards[BOTH], to_sq);
+    piece_of_square[to_sq] = piece_moved;
     hash_key ^= Zobrist.piece_keys[piece_moved][to_sq];
 
     // Handle promotion
@@ -239,7 +296,11 @@ bool Position::make_move(Move move) {
         hash_key ^= Zobrist.piece_keys[piece_moved][to_sq];
 
         set_bit(piece_bitboards[promotion_val_to_piece_type(promoted_type, side_to_move)], to_sq); // Add promoted piece
+        piece_of_square[to_sq] = promotion_val_to_piece_type(promoted_type, side_to_move);
         hash_key ^= Zobrist.piece_keys[promotion_val_to_piece_type(promoted_type, side_to_move)][to_sq];
+        add_piece_terms(promotion_val_to_piece_type(promoted_type, side_to_move), to_sq);
+    } else {
+        add_piece_terms(piece_moved, to_sq);
     }
 
     // Handle castling
@@ -249,44 +310,60 @@ bool Position::make_move(Move move) {
                 clear_bit(piece_bitboards[WR], H1);
                 clear_bit(occupancy_bitboards[WHITE], H1);
                 clear_bit(occupancy_bitboards[BOTH], H1);
+                piece_of_square[H1] = NO_PIECE;
                 hash_key ^= Zobrist.piece_keys[WR][H1];
+                remove_piece_terms(WR, H1);
 
                 set_bit(piece_bitboards[WR], F1);
                 set_bit(occupancy_bitboards[WHITE], F1);
                 set_bit(occupancy_bitboards[BOTH], F1);
+                piece_of_square[F1] = WR;
                 hash_key ^= Zobrist.piece_keys[WR][F1];
+                add_piece_terms(WR, F1);
             } else if (to_sq == C1) { // White queenside castling
                 clear_bit(piece_bitboards[WR], A1);
                 clear_bit(occupancy_bitboards[WHITE], A1);
                 clear_bit(occupancy_bitboards[BOTH], A1);
+                piece_of_square[A1] = NO_PIECE;
                 hash_key ^= Zobrist.piece_keys[WR][A1];
+                remove_piece_terms(WR, A1);
 
                 set_bit(piece_bitboards[WR], D1);
                 set_bit(occupancy_bitboards[WHITE], D1);
                 set_bit(occupancy_bitboards[BOTH], D1);
+                piece_of_square[D1] = WR;
                 hash_key ^= Zobrist.piece_keys[WR][D1];
+                add_piece_terms(WR, D1);
             }
         } else { // Black
             if (to_sq == G8) { // Black kingside castling
                 clear_bit(piece_bitboards[BR], H8);
                 clear_bit(occupancy_bitboards[BLACK], H8);
                 clear_bit(occupancy_bitboards[BOTH], H8);
+                piece_of_square[H8] = NO_PIECE;
                 hash_key ^= Zobrist.piece_keys[BR][H8];
+                remove_piece_terms(BR, H8);
 
                 set_bit(piece_bitboards[BR], F8);
                 set_bit(occupancy_bitboards[BLACK], F8);
                 set_bit(occupancy_bitboards[BOTH], F8);
+                piece_of_square[F8] = BR;
                 hash_key ^= Zobrist.piece_keys[BR][F8];
+                add_piece_terms(BR, F8);
             } else if (to_sq == C8) { // Black queenside castling
                 clear_bit(piece_bitboards[BR], A8);
                 clear_bit(occupancy_bitboards[BLACK], A8);
                 clear_bit(occupancy_bitboards[BOTH], A8);
+                piece_of_square[A8] = NO_PIECE;
                 hash_key ^= Zobrist.piece_keys[BR][A8];
+                remove_piece_terms(BR, A8);
 
                 set_bit(piece_bitboards[BR], D8);
                 set_bit(occupancy_bitboards[BLACK], D8);
                 set_bit(occupancy_bitboards[BOTH], D8);
+                piece_of_square[D8] = BR;
                 hash_key ^= Zobrist.piece_keys[BR][D8];
+                add_piece_terms(BR, D8);
             }
         }
     }
@@ -299,7 +376,9 @@ bool Position::make_move(Move move) {
         clear_bit(piece_bitboards[pawn_type], captured_pawn_sq);
         clear_bit(occupancy_bitboards[(side_to_move == WHITE ? BLACK : WHITE)], captured_pawn_sq);
         clear_bit(occupancy_bitboards[BOTH], captured_pawn_sq);
+        piece_of_square[captured_pawn_sq] = NO_PIECE;
         hash_key ^= Zobrist.piece_keys[pawn_type][captured_pawn_sq];
+        remove_piece_terms(pawn_type, captured_pawn_sq);
     }
 
     // Update en passant square
@@ -315,6 +394,7 @@ bool Position::make_move(Move move) {
 
     // Update castling rights
     hash_key ^= Zobrist.castling_keys[castling_rights]; // Remove old castling rights from hash
+    book_key ^= Polyglot.castling_keys[castling_rights];
 
     if (piece_moved == WK || from_sq == E1) {
         castling_rights = (CastlingRights)(castling_rights & ~(WHITE_KINGSIDE | WHITE_QUEENSIDE));
@@ -340,20 +420,25 @@ bool Position::make_move(Move move) {
     }
 
     hash_key ^= Zobrist.castling_keys[castling_rights]; // Add new castling rights to hash
+    book_key ^= Polyglot.castling_keys[castling_rights];
 
     if (side_to_move == BLACK) {
         fullmove_number++;
     }
 
     side_to_move = (side_to_move == WHITE) ? BLACK : WHITE;
+    hash_key ^= Zobrist.side_to_move_key;
+    book_key ^= Polyglot.side_to_move_key ^ polyglot_ep_key(*this);
 
     // Check if move is legal
-    Square king_sq = get_king_square(*this, side_to_move == WHITE ? BLACK : WHITE);
-    if (is_square_attacked(king_sq, side_to_move)) {
+    Color us = (side_to_move == WHITE) ? BLACK : WHITE;
+    Bitboard occ = occupancy_bitboards[BOTH];
+    if (attackers_to(get_king_square(*this, us), occ) & occupancy_bitboards[side_to_move]) {
         unmake_move(move);
         return false;
     }
 
+    checkers = attackers_to(get_king_square(*this, side_to_move), occ) & occupancy_bitboards[us];
     return true;
 }
 
@@ -367,41 +452,65 @@ void Position::make_null_move() {
     si.prev_ep_file = en_passant_sq == NO_SQUARE ? -1 : file_of(en_passant_sq);
     si.prev_halfmove = halfmove_clock;
     si.prev_zobrist = hash_key;
-    si.eval_delta = 0;
+    si.prev_psq_mg = psq_mg;
+    si.prev_psq_eg = psq_eg;
+    si.prev_phase = phase;
     si.nnue_delta_count = 0;
-    history[history_size++] = si;
+    si.prev_checkers = checkers;
+    si.prev_pawn_key = pawn_key;
+    si.prev_book_key = book_key;
+    states->put(history_size++, si);
 
     hash_key ^= Zobrist.side_to_move_key;
+    book_key ^= Polyglot.side_to_move_key ^ polyglot_ep_key(*this);
+
+    // The en passant right expires with the null move
+    if (en_passant_sq != NO_SQUARE) {
+        hash_key ^= Zobrist.en_passant_keys[get_file(en_passant_sq)];
+        en_passant_sq = NO_SQUARE;
+    }
 
     side_to_move = (side_to_move == WHITE) ? BLACK : WHITE;
 
+    // Null moves are only made out of check, and the side that just passed
+    // cannot be giving check in a legal position
+    checkers = 0;
+
     halfmove_clock++;
 }
 
 void Position::unmake_null_move() {
-    StateInfo si = history[--history_size];
+    const StateInfo& si = (*states)[--history_size];
+
+    side_to_move = (side_to_move == WHITE) ? BLACK : WHITE;
 
     castling_rights = (CastlingRights)si.prev_castle;
     en_passant_sq = si.prev_ep_file == -1 ? NO_SQUARE : (Square)(si.prev_ep_file + (side_to_move == WHITE ? 40 : 16));
     halfmove_clock = si.prev_halfmove;
     hash_key = si.prev_zobrist;
-
-    side_to_move = (side_to_move == WHITE) ? BLACK : WHITE;
+    book_key = si.prev_book_key;
+    checkers = si.prev_checkers;
 }
 
 void Position::unmake_move(Move move) {
-    StateInfo si = history[--history_size];
+    const StateInfo& si = (*states)[--history_size];
 
-    // Restore state from StateInfo
+    side_to_move = (side_to_move == WHITE) ? BLACK : WHITE;
+
+    // Restore state from StateInfo (the en passant square is relative to the
+    // side that was to move before the move)
     castling_rights = (CastlingRights)si.prev_castle;
     en_passant_sq = si.prev_ep_file == -1 ? NO_SQUARE : (Square)(si.prev_ep_file + (side_to_move == WHITE ? 40 : 16));
     halfmove_clock = si.prev_halfmove;
     hash_key = si.prev_zobrist;
-    // eval_delta is handled in search
-
-    side_to_move = (side_to_move == WHITE) ? BLACK : WHITE;
+    checkers = si.prev_checkers;
+    psq_mg = si.prev_psq_mg;
+    psq_eg = si.prev_psq_eg;
+    phase = si.prev_phase;
+    pawn_key = si.prev_pawn_key;
+    book_key = si.prev_book_key;
 
-    if (side_to_move == WHITE) {
+    if (side_to_move == BLACK) {
         fullmove_number--;
     }
 
@@ -417,10 +526,12 @@ void Position::unmake_move(Move move) {
     clear_bit(piece_bitboards[piece_moved], to_sq);
     clear_bit(occupancy_bitboards[side_to_move], to_sq);
     clear_bit(occupancy_bitboards[BOTH], to_sq);
+    piece_of_square[to_sq] = NO_PIECE;
 
     set_bit(piece_bitboards[piece_moved], from_sq);
     set_bit(occupancy_bitboards[side_to_move], from_sq);
     set_bit(occupancy_bitboards[BOTH], from_sq);
+    piece_of_square[from_sq] = piece_moved;
 
     if (captured_piece != NO_PIECE) {
         if (flags & Move::EN_PASSANT) {
@@ -428,16 +539,18 @@ void Position::unmake_move(Move move) {
             set_bit(piece_bitboards[captured_piece], ep_sq);
             set_bit(occupancy_bitboards[(side_to_move == WHITE ? BLACK : WHITE)], ep_sq);
             set_bit(occupancy_bitboards[BOTH], ep_sq);
+            piece_of_square[ep_sq] = captured_piece;
         } else {
             set_bit(piece_bitboards[captured_piece], to_sq);
             set_bit(occupancy_bitboards[(side_to_move == WHITE ? BLACK : WHITE)], to_sq);
             set_bit(occupancy_bitboards[BOTH], to_sq);
+            piece_of_square[to_sq] = captured_piece;
         }
     }
 
+    // The pawn was never on the target square: remove the promoted piece instead
     if (promoted_piece != NO_PIECE) {
-        clear_bit(piece_bitboards[piece_moved], to_sq);
-        set_bit(piece_bitboards[promoted_piece], to_sq);
+        clear_bit(piece_bitboards[promoted_piece], to_sq);
     }
 
     if (flags & Move::CASTLING) {
@@ -446,32 +559,40 @@ void Position::unmake_move(Move move) {
                 clear_bit(piece_bitboards[WR], F1);
                 clear_bit(occupancy_bitboards[WHITE], F1);
                 clear_bit(occupancy_bitboards[BOTH], F1);
+                piece_of_square[F1] = NO_PIECE;
                 set_bit(piece_bitboards[WR], H1);
                 set_bit(occupancy_bitboards[WHITE], H1);
                 set_bit(occupancy_bitboards[BOTH], H1);
+                piece_of_square[H1] = WR;
             } else if (to_sq == C1) {
                 clear_bit(piece_bitboards[WR], D1);
                 clear_bit(occupancy_bitboards[WHITE], D1);
                 clear_bit(occupancy_bitboards[BOTH], D1);
+                piece_of_square[D1] = NO_PIECE;
                 set_bit(piece_bitboards[WR], A1);
                 set_bit(occupancy_bitboards[WHITE], A1);
                 set_bit(occupancy_bitboards[BOTH], A1);
+                piece_of_square[A1] = WR;
             }
         } else {
             if (to_sq == G8) {
                 clear_bit(piece_bitboards[BR], F8);
                 clear_bit(occupancy_bitboards[BLACK], F8);
                 clear_bit(occupancy_bitboards[BOTH], F8);
+                piece_of_square[F8] = NO_PIECE;
                 set_bit(piece_bitboards[BR], H8);
                 set_bit(occupancy_bitboards[BLACK], H8);
                 set_bit(occupancy_bitboards[BOTH], H8);
+                piece_of_square[H8] = BR;
             } else if (to_sq == C8) {
                 clear_bit(piece_bitboards[BR], D8);
                 clear_bit(occupancy_bitboards[BLACK], D8);
                 clear_bit(occupancy_bitboards[BOTH], D8);
+                piece_of_square[D8] = NO_PIECE;
                 set_bit(piece_bitboards[BR], A8);
                 set_bit(occupancy_bitboards[BLACK], A8);
                 set_bit(occupancy_bitboards[BOTH], A8);
+                piece_of_square[A8] = BR;
             }
         }
     }
@@ -33,9 +33,35 @@ struct StateInfo {
     int8_t prev_ep_file;
     uint16_t prev_halfmove;
     uint64_t prev_zobrist;
-    int32_t eval_delta;
+    int16_t prev_psq_mg;
+    int16_t prev_psq_eg;
     uint8_t nnue_delta_count;
-    uint8_t padding[9]; // Padding to 32 bytes
+    uint8_t prev_phase;
+    uint8_t padding[2];
+    uint64_t prev_checkers;
+    uint64_t prev_pawn_key;
+    uint64_t prev_book_key;
+};
+
+// Undo records for make_move/unmake_move. The stack is owned outside the
+// Position so that copying a board copies only the board: a copy keeps
+// pointing at its parent's stack and pushes above the parent's top, which is
+// safe as long as the parent does not move while the copy is in use. Each
+// thread that makes moves needs a stack of its own.
+class StateStack {
+public:
+    StateStack() : states(1024) {}
+
+    // Store `si` at index `i`, growing the stack when it is full
+    void put(size_t i, const StateInfo& si) {
+        if (i >= states.size()) states.resize(states.size() * 2);
+        states[i] = si;
+    }
+
+    const StateInfo& operator[](size_t i) const { return states[i]; }
+
+private:
+    std::vector<StateInfo> states;
 };
 
 class Position {
@@ -51,20 +77,41 @@ public:
     // Zobrist hash key for transposition table
     uint64_t hash_key;
 
-    // Piece on square array
-    uint8_t piece_of_square[64];
+    // Zobrist key of the pawns alone, for the pawn structure cache
+    uint64_t pawn_key;
+
+    // Polyglot key of the position, for opening book lookups
+    uint64_t book_key;
 
-    // Zobrist history stack
-    uint64_t zobrist_history[MAX_PLY];
+    // Pieces giving check to the side to move, updated by every move
+    Bitboard checkers;
 
-    // NNUE delta buffer: max 8 toggles per ply
-    uint8_t nnue_delta_buffer[MAX_PLY * 8];
+    // Classical evaluation terms kept up to date by make_move: material plus
+    // piece-square sums from White's point of view, and the phase weight of
+    // the pieces on the board
+    int psq_mg;
+    int psq_eg;
+    int phase;
 
-    // History stack for unmake_move
-    std::array<StateInfo, 1024> history;
+    // Mailbox: piece on each square (NO_PIECE if empty), kept in step with
+    // the bitboards by make_move/unmake_move
+    uint8_t piece_of_square[64];
+
+    // Undo stack for unmake_move; history_size is this position's top
+    StateStack* states = nullptr;
     size_t history_size = 0;
 
+    // A default-constructed position has no undo stack and can only be
+    // assigned to or copied from; bind one with set_state_stack()
     Position();
+    explicit Position(StateStack& stack);
+
+    // Move this position onto `stack`, copying the moves played so far so
+    // that repetition detection still sees the game history
+    void set_state_stack(StateStack& stack);
+
+    // Undo record for the i-th move from the bottom of the stack
+    const StateInfo& history(size_t i) const { return (*states)[i]; }
 
     // Set up position from FEN string
     void set_from_fen(const std::string& fen);
@@ -77,15 +124,28 @@ public:
     void make_null_move();
     void unmake_null_move();
 
+    // All pieces of either color attacking `sq` with the given occupancy,
+    // found by looking outward from the square
+    Bitboard attackers_to(Square sq, Bitboard occupied) const;
+
     // Check if square is attacked by a given color
     bool is_square_attacked(Square sq, Color by_color) const;
 
     // Check if the current side to move is in check
     bool is_check() const;
 
+    // Check if the position repeats one since the last irreversible move.
+    // Moves made within the last `ply` plies belong to the search tree.
+    bool is_repetition(int ply) const;
+
     // Get piece on a square
     PieceType piece_on_square(Square sq) const;
 
+    // Add or remove a piece's contribution to psq_mg, psq_eg, phase,
+    // pawn_key and book_key
+    void add_piece_terms(int pt, Square sq);
+    void remove_piece_terms(int pt, Square sq);
+
     // Print board (for debugging)
     void print_board() const;
 
@@ -2,12 +2,34 @@
 #include "position.h"
 #include "bitboard.h"
 #include "nnue.h"
+#include "pawns.h"
+#include <memory>
 
 // --- Global flag for NNUE ---
 static bool USE_NNUE = false;
 
+// --- Evaluation Cache ---
+// Network scores, direct-mapped and private to each search thread. An entry
+// packs the upper half of the salted position key above the biased score in
+// one word, and zero marks an empty slot. The salt changes each time a net is
+// loaded, so scores from a previous net never match.
+const size_t EVAL_CACHE_SIZE = 1 << 16;
+const int32_t EVAL_CACHE_BIAS = 1 << 20;
+static uint64_t eval_cache_salt = 0;
+
+EvalCaches::EvalCaches() : nnue_scores(new uint64_t[EVAL_CACHE_SIZE]()) {}
+
 void set_use_nnue(bool use_nnue) {
     USE_NNUE = use_nnue && NNUE::nnue_available;
+    if (USE_NNUE) eval_cache_salt += 0x9E3779B97F4A7C15ULL;
+}
+
+bool probe_eval_cache(const Position& pos, const EvalCaches& caches, int& score) {
+    uint64_t key = pos.hash_key ^ eval_cache_salt;
+    uint64_t entry = caches.nnue_scores[key & (EVAL_CACHE_SIZE - 1)];
+    if (entry == 0 || (entry >> 32) != (key >> 32)) return false;
+    score = (int32_t)(uint32_t)entry - EVAL_CACHE_BIAS;
+    return true;
 }
 
 // --- Material Values (centipawns) ---
@@ -155,49 +177,42 @@ const int PST_KING_EG[64] = {
 const int* PST_MG[] = { PST_PAWN_MG, PST_KNIGHT_MG, PST_BISHOP_MG, PST_ROOK_MG, PST_QUEEN_MG, PST_KING_MG };
 const int* PST_EG[] = { PST_PAWN_EG, PST_KNIGHT_EG, PST_BISHOP_EG, PST_ROOK_EG, PST_QUEEN_EG, PST_KING_EG };
 
+int PSQ_MG[12][64];
+int PSQ_EG[12][64];
+
+void init_psqt() {
+    for (int pt = 0; pt < 6; ++pt) {
+        for (int sq = 0; sq < 64; ++sq) {
+            // Black uses the same tables with the board flipped
+            PSQ_MG[pt][sq] = MATERIAL[pt] + PST_MG[pt][sq];
+            PSQ_EG[pt][sq] = MATERIAL[pt] + PST_EG[pt][sq];
+            PSQ_MG[pt + 6][sq] = -MATERIAL[pt] - PST_MG[pt][sq ^ 56];
+            PSQ_EG[pt + 6][sq] = -MATERIAL[pt] - PST_EG[pt][sq ^ 56];
+        }
+    }
+}
+
 // --- Game Phase ---
-const int PHASE_VALUES[] = {0, 1, 1, 2, 4, 0}; // Pawn, Knight, Bishop, Rook, Queen, King
+const int PIECE_PHASE[12] = {0, 1, 1, 2, 4, 0, 0, 1, 1, 2, 4, 0};
 const int TOTAL_PHASE = 24; // Sum of phase values for all pieces at start
 
+// Position::phase counts the phase weight still on the board, so the game
+// phase runs from 0 at the start to 256 with only kings and pawns left
 int get_game_phase(const Position& pos) {
-    int phase = TOTAL_PHASE;
-    for (int pt = WP; pt <= BK; ++pt) {
-        Bitboard bb = pos.piece_bitboards[pt];
-        phase -= popcnt(bb) * PHASE_VALUES[pt % 6];
-    }
+    int phase = TOTAL_PHASE - pos.phase;
     return (phase * 256 + (TOTAL_PHASE / 2)) / TOTAL_PHASE;
 }
 
-// --- Evaluation Function ---
-int evaluate(const Position& pos) {
-    if (USE_NNUE) {
-        return NNUE::nnue_evaluator.evaluate(pos.side_to_move);
-    }
-
-    // --- Classical Evaluation Fallback ---
-    int score_mg = 0;
-    int score_eg = 0;
+// --- Classical Evaluation Fallback ---
+static int classical_eval(const Position& pos, PawnTable& pawn_table) {
     int phase = get_game_phase(pos);
 
-    // --- Material and PST ---
-    for (int pt_idx = 0; pt_idx < 12; ++pt_idx) {
-        Bitboard bb = pos.piece_bitboards[pt_idx];
-        int material_value = (pt_idx < 6) ? MATERIAL[pt_idx] : -MATERIAL[pt_idx % 6];
-        
-        while (bb) {
-            Square sq = pop_bit(bb);
-            score_mg += material_value;
-            score_eg += material_value;
-
-            if (pt_idx < 6) { // White
-                score_mg += PST_MG[pt_idx][sq];
-                score_eg += PST_EG[pt_idx][sq];
-            } else { // Black
-                score_mg -= PST_MG[pt_idx % 6][sq ^ 56]; // Flip square for black
-                score_eg -= PST_EG[pt_idx % 6][sq ^ 56];
-            }
-        }
-    }
+    // --- Pawn Structure and King Shelter (cached by pawn key) ---
+    const PawnEntry& pawns = pawn_table.probe(pos);
+    int score_mg = pos.psq_mg + pawns.score_mg
+                 + pawns.shelter[WHITE][file_of((Square)lsb_index(pos.piece_bitboards[WK]))]
+                 - pawns.shelter[BLACK][file_of((Square)lsb_index(pos.piece_bitboards[BK]))];
+    int score_eg = pos.psq_eg + pawns.score_eg;
 
     // --- Interpolate based on game phase ---
     int final_score = ((score_mg * (256 - phase)) + (score_eg * phase)) / 256;
@@ -206,4 +221,23 @@ int evaluate(const Position& pos) {
     final_score += (pos.side_to_move == WHITE) ? 10 : -10;
 
     return (pos.side_to_move == WHITE) ? final_score : -final_score;
-}
\ No newline at end of file
+}
+
+// --- Evaluation Function ---
+int evaluate(const Position& pos, EvalCaches& caches) {
+    // The classical terms are kept incrementally and cost less than a cache
+    // miss, so only network evaluations go through the cache
+    if (!USE_NNUE) {
+        return classical_eval(pos, caches.pawns);
+    }
+
+    int score;
+    if (probe_eval_cache(pos, caches, score)) {
+        return score;
+    }
+
+    score = NNUE::nnue_evaluator.evaluate(pos);
+    uint64_t key = pos.hash_key ^ eval_cache_salt;
+    caches.nnue_scores[key & (EVAL_CACHE_SIZE - 1)] = (key & 0xFFFFFFFF00000000ULL) | (uint32_t)(score + EVAL_CACHE_BIAS);
+    return score;
+}
@@ -1,13 +1,45 @@
 #ifndef EVALUATE_H
 #define EVALUATE_H
 
+#include "pawns.h"
+#include <cstdint>
+#include <memory>
+
 // Forward declaration
 class Position;
 
-// Call this to enable/disable NNUE based on options
+// Material plus piece-square bonus for every piece on every square, from
+// White's point of view, in the midgame and the endgame. Position keeps the
+// sums of these up to date as moves are made.
+extern int PSQ_MG[12][64];
+extern int PSQ_EG[12][64];
+
+// Weight of each piece in the game phase
+extern const int PIECE_PHASE[12];
+
+// Fill PSQ_MG and PSQ_EG; call once at startup
+void init_psqt();
+
+// Call this to enable/disable NNUE based on options. Enable it once per net
+// load: each enable starts a new generation of cached network scores.
 void set_use_nnue(bool use_nnue);
 
-// Main evaluation function
-int evaluate(const Position& pos);
+// Caches the evaluation reads and fills. Each search thread owns one and
+// keeps it across searches, so structures and positions met on earlier
+// moves of the game are still there. Network scores are keyed with a salt
+// that changes with the net, so they never outlive it.
+struct EvalCaches {
+    PawnTable pawns;
+    std::unique_ptr<uint64_t[]> nnue_scores;
+
+    EvalCaches();
+};
+
+// Cached network score for `pos` from the current net, if there is one
+bool probe_eval_cache(const Position& pos, const EvalCaches& caches, int& score);
+
+// Main evaluation function. Network scores are cached by position key, so
+// evaluating the same position again is a table lookup.
+int evaluate(const Position& pos, EvalCaches& caches);
 
 #endif // EVALUATE_H
\ No newline at end of file
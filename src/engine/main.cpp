@@ -3,6 +3,7 @@
 #include <vector>
 #include <sstream>
 #include <cstring>
+#include <cctype>
 #include "position.h"
 #include "movegen.h"
 #include "engine.h"
@@ -18,6 +19,10 @@
 #include "book.h"
 #include "syzygy.h"
 #include "zobrist.h"
+#include "perft.h"
+#include "bench.h"
+#include "timeman.h"
+#include "movepicker.h"
 #include <iostream>
 #include <algorithm>
 #include <cmath>
@@ -28,6 +33,8 @@
 #include <chrono>
 #include <unordered_map>
 #include <list>
+#include <filesystem>
+#include <fstream>
 
 #include "book.h"
 #include "nnue.h"
@@ -157,7 +164,8 @@ void print_result(const SearchResult& result, const Position& pos) {
 
 void run_perft_tests() {
     std::cout << "Running perft tests..." << std::endl;
-    Position pos;
+    StateStack states;
+    Position pos(states);
     pos.set_from_fen(START_FEN);
 
     // Perft targets from spec
@@ -181,7 +189,8 @@ void run_tests() {
     std::cout << "Running unit tests..." << std::endl;
 
     // Zobrist invariance test
-    Position pos;
+    StateStack states;
+    Position pos(states);
     pos.set_from_fen(START_FEN);
     uint64_t original_key = pos.hash_key;
 
@@ -200,38 +209,331 @@ void run_tests() {
         }
     }
 
+    // The incrementally updated key must match one computed from scratch,
+    // side to move and en passant square included
+    {
+        pos.set_from_fen(START_FEN);
+        pos.make_move(get_move_from_uci("e2e4", pos));
+        StateStack fen_states;
+        Position from_fen(fen_states);
+        from_fen.set_from_fen("rnbqkbnr/pppppppp/8/8/4P3/8/PPPP1PPP/RNBQKBNR b KQkq e3 0 1");
+        std::cout << "Zobrist incremental: " << (pos.hash_key == from_fen.hash_key ? "PASS" : "FAIL") << std::endl;
+    }
+
+    // Polyglot keys must match the reference values published with the book
+    // format, through castling, en passant and king moves, and be restored by
+    // unmake_move
+    {
+        const char* line[] = {"e2e4", "d7d5", "e4e5", "f7f5", "e1e2", "e8f7"};
+        const uint64_t keys[] = {0x823c9b50fd114196ULL, 0x0756b94461c50fb0ULL, 0x662fafb965db29d4ULL,
+                                 0x22a48b5a8e47ff78ULL, 0x652a607ca3f242c1ULL, 0x00fdd303c946bdd9ULL};
+        pos.set_from_fen(START_FEN);
+        bool poly_ok = pos.book_key == 0x463b96181691fc9cULL;
+        std::vector<Move> played;
+        for (int i = 0; i < 6; ++i) {
+            played.push_back(get_move_from_uci(line[i], pos));
+            pos.make_move(played.back());
+            poly_ok = poly_ok && pos.book_key == keys[i];
+        }
+        while (!played.empty()) {
+            pos.unmake_move(played.back());
+            played.pop_back();
+        }
+        poly_ok = poly_ok && pos.book_key == 0x463b96181691fc9cULL;
+        for (const char* uci : {"a2a4", "b7b5", "h2h4", "b5b4", "c2c4"}) pos.make_move(get_move_from_uci(uci, pos));
+        poly_ok = poly_ok && pos.book_key == 0x3c8123ea7b067637ULL;
+        for (const char* uci : {"b4c3", "a1a3"}) pos.make_move(get_move_from_uci(uci, pos));
+        poly_ok = poly_ok && pos.book_key == 0x5c3f9b829b279560ULL;
+        std::cout << "Polyglot keys: " << (poly_ok ? "PASS" : "FAIL") << std::endl;
+    }
+
+    // The move picker must hand out every move of a position with far more
+    // than 128 quiet moves (218 legal moves, the known maximum)
+    {
+        pos.set_from_fen("R6R/3Q4/1Q4Q1/4Q3/2Q4Q/Q4Q2/pp1Q4/kBNN1KB1 w - - 0 1");
+        static const int no_history[12][64] = {};
+        Move no_killers[2] = {Move(0), Move(0)};
+        MovePicker picker(pos, Move(0), no_killers, no_history);
+        int picked = 0;
+        while (picker.next_move().value != 0) ++picked;
+        MoveList legal;
+        generate_legal_moves(pos, legal);
+        std::cout << "Move picker: " << (picked == 218 && legal.size() == 218 ? "PASS" : "FAIL") << std::endl;
+    }
+
     // NNUE parity test (if NNUE loaded)
     if (NNUE::nnue_available) {
         pos.set_from_fen(START_FEN);
         NNUE::nnue_evaluator.reset(pos);
-        int full_eval = NNUE::nnue_evaluator.evaluate(WHITE);
-
-        generate_moves(pos, moves);
-        if (!moves.empty()) {
-            Move m = moves[0];
+        int full_eval = NNUE::nnue_evaluator.evaluate(pos);
+
+        // Play a few plies incrementally and compare against a full refresh at
+        // each step, then unwind and check we are back at the root value
+        bool parity_ok = true;
+        std::vector<Move> played;
+        for (int ply = 0; ply < 4 && parity_ok; ++ply) {
+            generate_legal_moves(pos, moves);
+            if (moves.empty()) break;
+            Move m = moves[ply % moves.size()];
             pos.make_move(m);
             NNUE::nnue_evaluator.update_make(pos, m);
-            int inc_eval = NNUE::nnue_evaluator.evaluate(WHITE);
-            pos.unmake_move(m);
-            NNUE::nnue_evaluator.update_unmake(pos, m);
-
-            if (full_eval == inc_eval) {
-                std::cout << "NNUE parity: PASS" << std::endl;
-            } else {
-                std::cout << "NNUE parity: FAIL (" << full_eval << " vs " << inc_eval << ")" << std::endl;
+            played.push_back(m);
+
+            int inc_eval = NNUE::nnue_evaluator.evaluate(pos);
+            static NNUE::Evaluator fresh;
+            fresh.reset(pos);
+            int ref_eval = fresh.evaluate(pos);
+            if (inc_eval != ref_eval) {
+                std::cout << "NNUE parity: FAIL at ply " << ply + 1 << " (" << inc_eval << " vs " << ref_eval << ")" << std::endl;
+                parity_ok = false;
             }
         }
+        while (!played.empty()) {
+            pos.unmake_move(played.back());
+            NNUE::nnue_evaluator.update_unmake(pos, played.back());
+            played.pop_back();
+        }
+        if (parity_ok && NNUE::nnue_evaluator.evaluate(pos) != full_eval) {
+            std::cout << "NNUE parity: FAIL after unmake" << std::endl;
+            parity_ok = false;
+        }
+        if (parity_ok) {
+            std::cout << "NNUE parity: PASS" << std::endl;
+        }
     } else {
         std::cout << "NNUE not loaded, skipping parity test" << std::endl;
     }
 
+    // Repetition test: shuffle knights back to the start position. The
+    // second occurrence is a repetition inside the tree but not yet in the
+    // game; the third is one either way. A pawn move resets the scan.
+    {
+        pos.set_from_fen(START_FEN);
+        const char* shuffle[] = {"g1f3", "g8f6", "f3g1", "f6g8", "g1f3", "g8f6", "f3g1", "f6g8"};
+        bool rep_ok = true;
+        for (int i = 0; i < 8; ++i) {
+            pos.make_move(get_move_from_uci(shuffle[i], pos));
+            if (i == 3 && (pos.is_repetition(0) || !pos.is_repetition(4))) rep_ok = false;
+            if (i == 7 && !pos.is_repetition(0)) rep_ok = false;
+        }
+        pos.make_move(get_move_from_uci("e2e4", pos));
+        if (pos.is_repetition(MAX_PLY)) rep_ok = false;
+        std::cout << "Repetition detection: " << (rep_ok ? "PASS" : "FAIL") << std::endl;
+    }
+
+    // Incremental evaluation test: the material/PST sums, phase and pawn key
+    // kept by make_move must match a recount over the bitboards at every ply,
+    // and unmake_move must bring back the root values
+    {
+        pos.set_from_fen("r3k2r/Pppp1ppp/1b3nbN/nP6/BBP1P3/q4N2/Pp1P2PP/R2Q1RK1 w kq - 0 1");
+        int root_mg = pos.psq_mg, root_eg = pos.psq_eg, root_phase = pos.phase;
+        uint64_t root_pawn_key = pos.pawn_key;
+        bool psq_ok = true;
+        std::vector<Move> played;
+        for (int ply = 0; ply < 8 && psq_ok; ++ply) {
+            generate_legal_moves(pos, moves);
+            if (moves.empty()) break;
+            Move m = moves[(ply * 7) % moves.size()];
+            pos.make_move(m);
+            played.push_back(m);
+            int mg = 0, eg = 0, phase = 0;
+            uint64_t pawn_key = 0;
+            for (int pt = WP; pt <= BK; ++pt) {
+                Bitboard bb = pos.piece_bitboards[pt];
+                while (bb) {
+                    Square sq = pop_bit(bb);
+                    mg += PSQ_MG[pt][sq];
+                    eg += PSQ_EG[pt][sq];
+                    phase += PIECE_PHASE[pt];
+                    if (pt == WP || pt == BP) pawn_key ^= Zobrist.piece_keys[pt][sq];
+                }
+            }
+            if (pos.psq_mg != mg || pos.psq_eg != eg || pos.phase != phase || pos.pawn_key != pawn_key) psq_ok = false;
+        }
+        while (!played.empty()) {
+            pos.unmake_move(played.back());
+            played.pop_back();
+        }
+        if (pos.psq_mg != root_mg || pos.psq_eg != root_eg || pos.phase != root_phase || pos.pawn_key != root_pawn_key) psq_ok = false;
+        std::cout << "Incremental evaluation: " << (psq_ok ? "PASS" : "FAIL") << std::endl;
+    }
+
+    // Syzygy probe test: KQvK and KRvK tables where every position holds one
+    // value exercise path lookup, mapping, header parsing and the color
+    // handling; a capture into the table must be found by the root probe, and
+    // with room for one file the tables must take turns being mapped
+    {
+        namespace fs = std::filesystem;
+        fs::path dir = fs::temp_directory_path() / "chess_wizard_tb_test";
+        fs::create_directories(dir);
+        auto write_table = [&](const char* name, std::vector<uint8_t> bytes) {
+            bytes.resize(80); // File sizes are 16 mod 64
+            std::ofstream(dir / name, std::ios::binary).write((const char*)bytes.data(), bytes.size());
+        };
+        // Header, piece order K Q k, then one single-value sub-table per side
+        // to move: WDL win (4) for White and loss (0) for Black, DTZ 5 moves
+        write_table("KQvK.rtbw", {0x71, 0xE8, 0x23, 0x5D, 0x01, 0x00, 0x66, 0x55, 0xEE, 0x00, 0x80, 4, 0x80, 0});
+        write_table("KQvK.rtbz", {0xD7, 0x66, 0x0C, 0xA5, 0x01, 0x00, 0x06, 0x05, 0x0E, 0x00, 0x80, 5});
+        write_table("KRvK.rtbw", {0x71, 0xE8, 0x23, 0x5D, 0x01, 0x00, 0x66, 0x44, 0xEE, 0x00, 0x80, 4, 0x80, 0});
+        write_table("KRvK.rtbz", {0xD7, 0x66, 0x0C, 0xA5, 0x01, 0x00, 0x06, 0x04, 0x0E, 0x00, 0x80, 8});
+
+        bool tb_ok = syzygy_init(dir.string()) == 2 && TB_LARGEST == 3 && syzygy_mapped_bytes() == 0;
+        WDLScore wdl;
+        pos.set_from_fen("4k3/8/8/8/8/8/8/4K2Q w - - 0 1");
+        tb_ok = tb_ok && probe_wdl(pos, wdl) && wdl == WDL_WIN;
+        pos.set_from_fen("4k3/8/8/8/8/8/8/4K2Q b - - 0 1");
+        tb_ok = tb_ok && probe_wdl(pos, wdl) && wdl == WDL_LOSS;
+        pos.set_from_fen("4K3/8/8/8/8/8/8/4k2q b - - 0 1");
+        tb_ok = tb_ok && probe_wdl(pos, wdl) && wdl == WDL_WIN;
+        pos.set_from_fen("4k3/8/8/8/8/8/3q4/4K3 w - - 0 1");
+        TBResult tb_result;
+        tb_ok = tb_ok && probe_syzygy(pos, tb_result) && tb_result.best_move.to_uci_string() == "e1d2" && tb_result.score == 0;
+        pos.set_from_fen("4k3/8/8/8/8/8/8/4K2Q w - - 0 1");
+        tb_ok = tb_ok && probe_syzygy(pos, tb_result) && tb_result.score == TB_WIN_SCORE;
+        pos.set_from_fen("4k3/8/8/8/8/8/3r4/4K2Q w - - 0 1");
+        tb_ok = tb_ok && !probe_syzygy(pos, tb_result); // No KQvKR table
+
+        syzygy_set_map_limit(100);
+        tb_ok = tb_ok && syzygy_mapped_bytes() == 80; // Two KQvK files were mapped
+        for (const char* fen : {"4k3/8/8/8/8/8/8/4K2R w - - 0 1", "4k3/8/8/8/8/8/8/4K2Q w - - 0 1",
+                                "4k3/8/8/8/8/8/8/4K2R b - - 0 1"}) {
+            pos.set_from_fen(fen);
+            tb_ok = tb_ok && probe_wdl(pos, wdl) && wdl == (pos.side_to_move == WHITE ? WDL_WIN : WDL_LOSS);
+            tb_ok = tb_ok && syzygy_mapped_bytes() == 80;
+        }
+        syzygy_set_map_limit(0);
+
+        syzygy_init("");
+        tb_ok = tb_ok && TB_LARGEST == 0;
+        fs::remove_all(dir);
+        std::cout << "Syzygy probe: " << (tb_ok ? "PASS" : "FAIL") << std::endl;
+    }
+
+    // Opening book test: a small book with several moves for one position;
+    // lookups must list the playable moves with their weight shares, draw
+    // them in proportion with a seed, turn them into the engine's moves with
+    // their flags (castling written king-takes-rook, captures) and miss
+    // positions that are not in the book
+    {
+        namespace fs = std::filesystem;
+        fs::path path = fs::temp_directory_path() / "chess_wizard_book_test.bin";
+        struct Entry { uint64_t key; uint16_t move, weight; uint32_t learn; };
+        std::vector<Entry> entries;
+        auto key_of = [&](const std::string& fen) {
+            pos.set_from_fen(fen);
+            return pos.book_key;
+        };
+        const char* castle_fen = "r3k2r/8/8/8/8/8/8/R3K2R w KQkq - 0 1";
+        const char* capture_fen = "rnbqkbnr/ppp1pppp/8/3p4/4P3/8/PPPP1PPP/RNBQKBNR w KQkq d6 0 2";
+        entries.push_back({key_of(START_FEN), 731, 0, 900}); // d2d4, never played
+        entries.push_back({key_of(START_FEN), 666, 10, 0}); // c2c4
+        entries.push_back({key_of(START_FEN), 405, 30, 0}); // g1f3
+        entries.push_back({key_of(castle_fen), 263, 20, 600}); // e1h1
+        entries.push_back({key_of(capture_fen), 1827, 20, 600}); // e4d5
+        std::sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) { return a.key < b.key; });
+        std::vector<uint8_t> bytes;
+        for (const Entry& e : entries) {
+            for (int s = 56; s >= 0; s -= 8) bytes.push_back((uint8_t)(e.key >> s));
+            for (int s = 8; s >= 0; s -= 8) bytes.push_back((uint8_t)(e.move >> s));
+            for (int s = 8; s >= 0; s -= 8) bytes.push_back((uint8_t)(e.weight >> s));
+            for (int s = 24; s >= 0; s -= 8) bytes.push_back((uint8_t)(e.learn >> s));
+        }
+        std::ofstream(path, std::ios::binary).write((const char*)bytes.data(), bytes.size());
+
+        Book book;
+        bool book_ok = book.load(path.string()) && book.is_loaded();
+        pos.set_from_fen(START_FEN);
+        std::vector<BookMove> book_moves = book.get_moves(pos);
+        book_ok = book_ok && book_moves.size() == 2 && book_moves[0].move.to_uci_string() == "g1f3"
+                  && book_moves[0].probability == 0.75 && book_moves[1].probability == 0.25;
+        Move m = book.get_move(pos);
+        book_ok = book_ok && m.to_uci_string() == "g1f3" && m.moving_piece() == WN;
+        int knight_picks = 0;
+        for (uint64_t seed = 1; seed <= 1000; ++seed) {
+            Move pick = book.get_move(pos, seed);
+            book_ok = book_ok && pick.value == book.get_move(pos, seed).value;
+            if (pick.to_uci_string() == "g1f3") ++knight_picks;
+        }
+        book_ok = book_ok && knight_picks > 650 && knight_picks < 850;
+        pos.set_from_fen(castle_fen);
+        m = book.get_move(pos);
+        book_ok = book_ok && m.to_uci_string() == "e1g1" && (m.flags() & Move::CASTLING);
+        pos.set_from_fen(capture_fen);
+        m = book.get_move(pos);
+        book_ok = book_ok && m.to_uci_string() == "e4d5" && m.captured_piece() == BP;
+        pos.set_from_fen("rnbqkbnr/pppppppp/8/8/3P4/8/PPP1PPPP/RNBQKBNR b KQkq d3 0 1");
+        book_ok = book_ok && book.get_move(pos).value == 0;
+        fs::remove(path);
+        std::cout << "Opening book: " << (book_ok ? "PASS" : "FAIL") << std::endl;
+    }
+
+    // Evaluation cache test: a network score cached before a search must
+    // still hit after the next search with the same net, and must miss once
+    // a different net is loaded
+    {
+        namespace fs = std::filesystem;
+        fs::path dir = fs::temp_directory_path();
+        auto write_net = [&](const fs::path& path, int16_t bias) {
+            std::ofstream file(path, std::ios::binary);
+            file.write("CWNNUEv1", 8);
+            for (int32_t v : {NNUE::INPUT_SIZE, NNUE::HIDDEN_SIZE, 1, 0}) file.write((const char*)&v, sizeof(v));
+            std::vector<int16_t> weights(NNUE::INPUT_SIZE * NNUE::HIDDEN_SIZE + 2 * NNUE::HIDDEN_SIZE + 1);
+            for (size_t i = 0; i < weights.size(); ++i) weights[i] = (int16_t)(i * 7 % 23) - 11;
+            weights.back() = bias;
+            uint32_t checksum = 0;
+            file.write((const char*)weights.data(), weights.size() * sizeof(int16_t));
+            file.write((const char*)&checksum, sizeof(checksum));
+        };
+        fs::path net_a = dir / "chess_wizard_eval_a.nnue";
+        fs::path net_b = dir / "chess_wizard_eval_b.nnue";
+        write_net(net_a, 100);
+        write_net(net_b, -100);
+        std::string path_a = net_a.string(), path_b = net_b.string();
+
+        ChessWizardOptions opts = OPTIONS;
+        opts.use_nnue = true;
+        opts.nnue_path = path_a.c_str();
+        opts.book_path = nullptr;
+        opts.use_syzygy = false;
+        opts.threads = 1;
+        SearchLimits limits;
+        limits.max_depth = 2;
+        auto search_once = [&]() {
+            StateStack search_states;
+            Position search_pos(search_states);
+            search_pos.set_from_fen(START_FEN);
+            std::streambuf* saved = std::cout.rdbuf(nullptr);
+            SearchResult result = search_position(search_pos, limits, &opts);
+            std::cout.rdbuf(saved);
+            free(result.pv_json);
+            free(result.error_message);
+        };
+
+        search_once();
+        EvalCaches caches;
+        pos.set_from_fen("r1bqkbnr/pppp1ppp/2n5/4p3/4P3/5N2/PPPP1PPP/RNBQKB1R w KQkq - 2 3");
+        NNUE::nnue_evaluator.reset(pos);
+        int score = evaluate(pos, caches), cached = 0;
+        search_once();
+        bool cache_ok = NNUE::nnue_available && probe_eval_cache(pos, caches, cached) && cached == score;
+        opts.nnue_path = path_b.c_str();
+        search_once();
+        cache_ok = cache_ok && NNUE::nnue_available && !probe_eval_cache(pos, caches, cached);
+
+        set_use_nnue(false);
+        fs::remove(net_a);
+        fs::remove(net_b);
+        std::cout << "Evaluation cache: " << (cache_ok ? "PASS" : "FAIL") << std::endl;
+    }
+
     std::cout << "Tests completed." << std::endl;
 }
 
 void run_integration_tests() {
     std::cout << "Running integration tests..." << std::endl;
 
-    Position pos;
+    StateStack states;
+    Position pos(states);
     pos.set_from_fen(START_FEN);
     std::vector<uint64_t> targets = {20, 400, 8902, 197281, 4865609, 119060324};
 
@@ -250,8 +552,27 @@ void run_integration_tests() {
 
 
 // --- UCI Loop ---
+// Called on the search thread; writes the whole reply at once so it cannot
+// interleave with output from the input loop
+static void print_bestmove(const SearchResult& result) {
+    std::string reply = std::string("bestmove ") + (result.best_move_uci[0] ? result.best_move_uci : "0000");
+
+    // The second PV move is the reply we expect, suggested for pondering
+    std::string pv = result.pv_json ? result.pv_json : "";
+    size_t first = pv.find(',');
+    if (first != std::string::npos) {
+        size_t start = pv.find('"', first);
+        size_t end = pv.find('"', start + 1);
+        if (start != std::string::npos && end != std::string::npos) {
+            reply += " ponder " + pv.substr(start + 1, end - start - 1);
+        }
+    }
+    std::cout << reply << std::endl;
+}
+
 void uci_loop() {
-    Position pos;
+    StateStack states;
+    Position pos(states);
     pos.set_from_fen(START_FEN);
 
     std::string line;
@@ -264,14 +585,21 @@ void uci_loop() {
             std::cout << "id name Chess Wizard" << std::endl;
             std::cout << "id author Gemini" << std::endl;
             std::cout << "option name TT Size type spin default 32 min 1 max 1024" << std::endl;
+            std::cout << "option name Threads type spin default 1 min 1 max " << MAX_THREADS << std::endl;
+            std::cout << "option name MultiPV type spin default 1 min 1 max 255" << std::endl;
             std::cout << "option name Use NNUE type check default false" << std::endl;
             std::cout << "option name NNUE_File type string default" << std::endl;
             std::cout << "option name Book type string default" << std::endl;
+            std::cout << "option name Seed type spin default 0 min 0 max 2147483647" << std::endl;
             std::cout << "option name SyzygyPath type string default" << std::endl;
+            std::cout << "option name SyzygyMapLimit type spin default 0 min 0 max 1048576" << std::endl;
+            std::cout << "option name Move Overhead type spin default " << DEFAULT_MOVE_OVERHEAD << " min 0 max 5000" << std::endl;
             std::cout << "uciok" << std::endl;
         } else if (token == "isready") {
             std::cout << "readyok" << std::endl;
         } else if (token == "setoption") {
+            stop_search();
+            wait_for_search();
             std::string name_token, value_token, name, value;
             iss >> name_token >> name;
             if (name == "TT") {
@@ -279,6 +607,16 @@ void uci_loop() {
                 iss >> value_token >> value;
                 OPTIONS.tt_size_mb = std::stoi(value);
                 TT.resize(OPTIONS.tt_size_mb);
+            } else if (name == "Move") {
+                iss >> name; // "Overhead"
+                iss >> value_token >> value;
+                Time.move_overhead = std::clamp(std::stoi(value), 0, 5000);
+            } else if (name == "Threads") {
+                iss >> value_token >> value;
+                OPTIONS.threads = std::clamp(std::stoi(value), 1, MAX_THREADS);
+            } else if (name == "MultiPV") {
+                iss >> value_token >> value;
+                OPTIONS.multi_pv = (uint8_t)std::clamp(std::stoi(value), 1, 255);
             } else if (name == "Use") {
                 iss >> name; // "NNUE"
                 iss >> value_token >> value;
@@ -292,14 +630,25 @@ void uci_loop() {
                 BOOK_PATH_BUFFER = value;
                 OPTIONS.book_path = BOOK_PATH_BUFFER.c_str();
                 OPENING_BOOK.load(OPTIONS.book_path);
+            } else if (name == "Seed") {
+                // 0 plays the heaviest book move; others vary the line by weight
+                iss >> value_token >> value;
+                OPTIONS.seed = (uint64_t)std::max(0LL, std::stoll(value));
             } else if (name == "SyzygyPath") {
                 iss >> value_token >> value;
-                // A real implementation would initialize the tablebase here.
-                std::cout << "info string SyzygyPath set to " << value << std::endl;
+                OPTIONS.use_syzygy = syzygy_init(value) > 0;
+            } else if (name == "SyzygyMapLimit") {
+                // In MB; 0 maps tables without limit
+                iss >> value_token >> value;
+                syzygy_set_map_limit((size_t)std::clamp(std::stoi(value), 0, 1 << 20) << 20);
             }
         } else if (token == "ucinewgame") {
+            stop_search();
+            wait_for_search();
             pos.set_from_fen(START_FEN);
         } else if (token == "position") {
+            stop_search();
+            wait_for_search();
             std::string sub_token;
             iss >> sub_token;
             if (sub_token == "startpos") {
@@ -320,29 +669,45 @@ void uci_loop() {
                 }
             }
         } else if (token == "go") {
+            stop_search();
+            wait_for_search();
+
             SearchLimits limits;
+            bool ponder = false;
             std::string sub_token;
             while (iss >> sub_token) {
-                if (sub_token == "wtime") iss >> limits.movetime; // Simplified
-                if (sub_token == "btime") iss >> limits.movetime;
+                if (sub_token == "wtime") iss >> limits.wtime;
+                if (sub_token == "btime") iss >> limits.btime;
+                if (sub_token == "winc") iss >> limits.winc;
+                if (sub_token == "binc") iss >> limits.binc;
+                if (sub_token == "movestogo") iss >> limits.movestogo;
                 if (sub_token == "movetime") iss >> limits.movetime;
                 if (sub_token == "depth") iss >> limits.max_depth;
+                if (sub_token == "infinite") limits.infinite = true;
+                if (sub_token == "ponder") ponder = true;
             }
-            SearchResult result = search_position(pos, limits, &OPTIONS);
-            std::cout << "bestmove " << result.best_move_uci << std::endl;
+            start_search(pos, limits, &OPTIONS, ponder, print_bestmove);
+        } else if (token == "stop") {
+            stop_search();
+            wait_for_search();
+        } else if (token == "ponderhit") {
+            ponderhit();
         } else if (token == "perft") {
             int depth;
             iss >> depth;
-            uint64_t nodes = perft_debug(depth, pos, depth);
-            std::cout << "Perft " << depth << ": " << nodes << std::endl;
+            perft_divide(pos, depth, std::max(1u, OPTIONS.threads));
         } else if (token == "quit") {
             break;
         }
     }
+
+    stop_search();
+    wait_for_search();
 }
 
 void cli_loop() {
-    Position pos;
+    StateStack states;
+    Position pos(states);
     pos.set_from_fen(START_FEN);
     TT.resize(32);
     int time_ms = 2000; // default
@@ -359,7 +724,7 @@ void cli_loop() {
                 if (!OPENING_BOOK.is_loaded()) {
                     OPENING_BOOK.load(OPTIONS.book_path);
                 }
-                Move book_move = OPENING_BOOK.get_move(pos.hash_key);
+                Move book_move = OPENING_BOOK.get_move(pos, OPTIONS.seed);
                 if (book_move.value != 0) {
                     // Assume threshold met for simplicity
                     SearchResult result = {};
@@ -426,8 +791,8 @@ void cli_loop() {
         if (line == "undo") {
             if (pos.history_size >= 2) {
                 // Reconstruct last two moves from history
-                StateInfo si1 = pos.history[pos.history_size - 1];
-                StateInfo si2 = pos.history[pos.history_size - 2];
+                StateInfo si1 = pos.history(pos.history_size - 1);
+                StateInfo si2 = pos.history(pos.history_size - 2);
                 Move m1 = Move(0);
                 m1.set_from((Square)si1.from);
                 m1.set_to((Square)si1.to);
@@ -559,10 +924,12 @@ int main(int argc, char* argv[]) {
     bool is_bench = false;
     bool is_test = false;
     bool is_perft = false;
+    int perft_depth = 0;
+    int perft_threads = 1;
+    bool perft_copy_make = false;
+    std::string perft_fen = START_FEN;
     bool is_integration_test = false;
-    int bench_tt_size = 32;
-    int bench_time_ms = 10000;
-    std::string bench_position = START_FEN;
+    BenchOptions bench_opts;
 
     for (int i = 1; i < argc; ++i) {
         std::string arg = argv[i];
@@ -572,6 +939,24 @@ int main(int argc, char* argv[]) {
             is_test = true;
         } else if (arg == "--perft") {
             is_perft = true;
+            // With a depth, run the perft tool instead of the fixed test suite
+            if (i + 1 < argc && std::isdigit((unsigned char)argv[i + 1][0])) {
+                perft_depth = std::stoi(argv[++i]);
+                for (int j = i + 1; j < argc; ++j) {
+                    if (std::string(argv[j]) == "--threads" && j + 1 < argc) {
+                        perft_threads = std::stoi(argv[++j]);
+                    } else if (std::string(argv[j]) == "--copy-make") {
+                        perft_copy_make = true;
+                    } else if (std::string(argv[j]) == "--fen" && j + 1 < argc) {
+                        // Accept the FEN either quoted or as separate fields
+                        perft_fen = argv[++j];
+                        while (j + 1 < argc && std::strncmp(argv[j + 1], "--", 2) != 0) {
+                            perft_fen += " ";
+                            perft_fen += argv[++j];
+                        }
+                    }
+                }
+            }
         } else if (arg == "--integration-test") {
             is_integration_test = true;
         } else if (arg == "--bench") {
@@ -579,16 +964,15 @@ int main(int argc, char* argv[]) {
             // Parse bench options
             for (int j = i + 1; j < argc; ++j) {
                 if (std::string(argv[j]) == "--tt-size" && j + 1 < argc) {
-                    bench_tt_size = std::stoi(argv[++j]);
-                } else if (std::string(argv[j]) == "--time" && j + 1 < argc) {
-                    std::string time_str = argv[++j];
-                    if (time_str.back() == 's') {
-                        bench_time_ms = std::stoi(time_str.substr(0, time_str.size() - 1)) * 1000;
-                    } else {
-                        bench_time_ms = std::stoi(time_str);
-                    }
+                    bench_opts.tt_size_mb = std::stoi(argv[++j]);
+                } else if (std::string(argv[j]) == "--depth" && j + 1 < argc) {
+                    bench_opts.depth = std::stoi(argv[++j]);
+                } else if (std::string(argv[j]) == "--threads" && j + 1 < argc) {
+                    bench_opts.threads = std::max(1, std::stoi(argv[++j]));
+                } else if (std::string(argv[j]) == "--json") {
+                    bench_opts.json = true;
                 } else if (std::string(argv[j]) == "--position" && j + 1 < argc) {
-                    bench_position = argv[++j];
+                    bench_opts.fen = argv[++j];
                 }
             }
         }
@@ -600,7 +984,18 @@ int main(int argc, char* argv[]) {
     }
 
     if (is_perft) {
-        run_perft_tests();
+        if (perft_depth > 0) {
+            StateStack states;
+            Position pos(states);
+            pos.set_from_fen(perft_fen);
+            if (perft_copy_make) {
+                perft_compare(pos, perft_depth);
+            } else {
+                perft_divide(pos, perft_depth, perft_threads);
+            }
+        } else {
+            run_perft_tests();
+        }
         return 0;
     }
 
@@ -610,39 +1005,7 @@ int main(int argc, char* argv[]) {
     }
 
     if (is_bench) {
-        TT.resize(bench_tt_size);
-        Position pos;
-        pos.set_from_fen(bench_position);
-
-        auto start = std::chrono::steady_clock::now();
-        uint64_t total_nodes = 0;
-        int max_depth = 0;
-
-        while (true) {
-            auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
-            if (elapsed >= bench_time_ms) break;
-
-            SearchLimits limits;
-            limits.movetime = bench_time_ms - elapsed;
-            limits.max_depth = 64;
-
-            SearchResult result = search_position(pos, limits, &OPTIONS);
-            total_nodes += result.nodes;
-            max_depth = std::max(max_depth, (int)result.depth);
-
-            if (result.nodes == 0) break;
-        }
-
-        auto end = std::chrono::steady_clock::now();
-        auto total_time = std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
-        double nps = total_nodes * 1000.0 / total_time;
-
-        std::cout << "Benchmark results:" << std::endl;
-        std::cout << "Total nodes: " << total_nodes << std::endl;
-        std::cout << "Max depth: " << max_depth << std::endl;
-        std::cout << "Time: " << total_time << " ms" << std::endl;
-        std::cout << "Nodes/sec: " << (uint64_t)nps << std::endl;
-
+        run_bench(bench_opts, OPTIONS);
         return 0;
     }
 
@@ -39,9 +39,8 @@ std::string Move::to_san_string(const Position& pos) const {
     if (generic != 0) san += piece_char; // not pawn
 
     // Disambiguation
-    Position temp_pos = pos;
     MoveList legal_moves;
-    generate_legal_moves(temp_pos, legal_moves);
+    generate_legal_moves(pos, legal_moves);
     std::vector<Move> candidates;
     for (const auto& m : legal_moves) {
         if (m.to() == to() && (m.moving_piece() % 6) == generic) {
@@ -69,6 +68,7 @@ std::string Move::to_san_string(const Position& pos) const {
     }
 
     // Check if gives check or mate
+    Position temp_pos = pos;
     temp_pos.make_move(*this);
     if (temp_pos.is_check()) {
         MoveList after_moves;
@@ -107,11 +107,8 @@ Move get_move_from_uci(const std::string& uci_str, const Position& pos) {
     }
 
     // Generate all legal moves for the current position
-    // Note: This requires a non-const Position object for make_move/unmake_move
-    // We'll make a copy to avoid modifying the original const Position
-    Position temp_pos = pos;
     MoveList legal_moves;
-    generate_legal_moves(temp_pos, legal_moves);
+    generate_legal_moves(pos, legal_moves);
 
     // Find the matching legal move
     for (const auto& move : legal_moves) {
@@ -4,7 +4,10 @@
 #include "move.h"
 #include <iostream>
 
-void generate_pawn_moves(const Position& pos, Move* captures, int& num_captures, Move* quiets, int& num_quiets, bool captures_only) {
+// Which part of the pseudo-legal move set a generator call fills in
+enum GenType { GEN_CAPTURES, GEN_QUIETS, GEN_ALL };
+
+void generate_pawn_moves(const Position& pos, Move* captures, int& num_captures, Move* quiets, int& num_quiets, GenType type) {
     Color us = pos.side_to_move;
     Color them = (us == WHITE) ? BLACK : WHITE;
     Bitboard our_pawns = pos.piece_bitboards[us == WHITE ? WP : BP];
@@ -22,7 +25,7 @@ void generate_pawn_moves(const Position& pos, Move* captures, int& num_captures,
         Rank r = get_rank(from);
 
         // --- Pushes ---
-        if (!captures_only) {
+        if (type != GEN_CAPTURES) {
             Square to = static_cast<Square>(from + push_offset);
             if (!get_bit(all_pieces, to)) {
                 if (get_rank(to) == promotion_rank) {
@@ -45,6 +48,7 @@ void generate_pawn_moves(const Position& pos, Move* captures, int& num_captures,
         }
 
         // --- Captures ---
+        if (type == GEN_QUIETS) continue;
         Bitboard attacks = PAWN_ATTACKS[us][from];
         Bitboard attackable = their_pieces;
         if (pos.en_passant_sq != NO_SQUARE) {
@@ -72,7 +76,7 @@ void generate_pawn_moves(const Position& pos, Move* captures, int& num_captures,
 }
 
 template<PieceType Pt>
-void generate_piece_moves(const Position& pos, Move* captures, int& num_captures, Move* quiets, int& num_quiets, bool captures_only) {
+void generate_piece_moves(const Position& pos, Move* captures, int& num_captures, Move* quiets, int& num_quiets, GenType type) {
     Color us = pos.side_to_move;
     Bitboard our_pieces = pos.piece_bitboards[Pt];
     Bitboard their_pieces = pos.occupancy_bitboards[us == WHITE ? BLACK : WHITE];
@@ -82,7 +86,9 @@ void generate_piece_moves(const Position& pos, Move* captures, int& num_captures
         Square from = pop_bit(our_pieces);
         Bitboard attacks = get_piece_attacks(Pt, from, all_pieces);
 
-        Bitboard targets = captures_only ? (attacks & their_pieces) : ((attacks & ~all_pieces) | (attacks & their_pieces));
+        Bitboard targets = 0;
+        if (type != GEN_QUIETS) targets |= attacks & their_pieces;
+        if (type != GEN_CAPTURES) targets |= attacks & ~all_pieces;
 
         while (targets) {
             Square to = pop_bit(targets);
@@ -98,42 +104,39 @@ void generate_piece_moves(const Position& pos, Move* captures, int& num_captures
 
 void generate_castling_moves(const Position& pos, Move* quiets, int& num_quiets) {
     Color us = pos.side_to_move;
-    if (pos.is_check()) return;
+    if (pos.checkers) return;
+
+    Bitboard occ = pos.occupancy_bitboards[BOTH];
+    Bitboard their_pieces = pos.occupancy_bitboards[us == WHITE ? BLACK : WHITE];
+    // The king's start square is known to be safe since we are not in check
+    auto safe = [&](Square sq) { return !(pos.attackers_to(sq, occ) & their_pieces); };
 
     if (us == WHITE) {
         if ((pos.castling_rights & WHITE_KINGSIDE) &&
-            !get_bit(pos.occupancy_bitboards[BOTH], F1) &&
-            !get_bit(pos.occupancy_bitboards[BOTH], G1) &&
-            !pos.is_square_attacked(E1, BLACK) &&
-            !pos.is_square_attacked(F1, BLACK) &&
-            !pos.is_square_attacked(G1, BLACK)) {
+            !get_bit(occ, F1) &&
+            !get_bit(occ, G1) &&
+            safe(F1) && safe(G1)) {
             quiets[num_quiets++] = create_move(E1, G1, WK, NO_PIECE, Move::NO_PROMOTION, Move::CASTLING);
         }
         if ((pos.castling_rights & WHITE_QUEENSIDE) &&
-            !get_bit(pos.occupancy_bitboards[BOTH], D1) &&
-            !get_bit(pos.occupancy_bitboards[BOTH], C1) &&
-            !get_bit(pos.occupancy_bitboards[BOTH], B1) &&
-            !pos.is_square_attacked(E1, BLACK) &&
-            !pos.is_square_attacked(D1, BLACK) &&
-            !pos.is_square_attacked(C1, BLACK)) {
+            !get_bit(occ, D1) &&
+            !get_bit(occ, C1) &&
+            !get_bit(occ, B1) &&
+            safe(D1) && safe(C1)) {
             quiets[num_quiets++] = create_move(E1, C1, WK, NO_PIECE, Move::NO_PROMOTION, Move::CASTLING);
         }
     } else { // BLACK
         if ((pos.castling_rights & BLACK_KINGSIDE) &&
-            !get_bit(pos.occupancy_bitboards[BOTH], F8) &&
-            !get_bit(pos.occupancy_bitboards[BOTH], G8) &&
-            !pos.is_square_attacked(E8, WHITE) &&
-            !pos.is_square_attacked(F8, WHITE) &&
-            !pos.is_square_attacked(G8, WHITE)) {
+            !get_bit(occ, F8) &&
+            !get_bit(occ, G8) &&
+            safe(F8) && safe(G8)) {
             quiets[num_quiets++] = create_move(E8, G8, BK, NO_PIECE, Move::NO_PROMOTION, Move::CASTLING);
         }
         if ((pos.castling_rights & BLACK_QUEENSIDE) &&
-            !get_bit(pos.occupancy_bitboards[BOTH], D8) &&
-            !get_bit(pos.occupancy_bitboards[BOTH], C8) &&
-            !get_bit(pos.occupancy_bitboards[BOTH], B8) &&
-            !pos.is_square_attacked(E8, WHITE) &&
-            !pos.is_square_attacked(D8, WHITE) &&
-            !pos.is_square_attacked(C8, WHITE)) {
+            !get_bit(occ, D8) &&
+            !get_bit(occ, C8) &&
+            !get_bit(occ, B8) &&
+            safe(D8) && safe(C8)) {
             quiets[num_quiets++] = create_move(E8, C8, BK, NO_PIECE, Move::NO_PROMOTION, Move::CASTLING);
         }
     }
@@ -150,31 +153,79 @@ void generate_moves(const Position& pos, MoveList& moves, bool captures_only) {
     for (int i = 0; i < num_quiets; ++i) moves.push_back(quiets[i]);
 }
 
-void generate_moves(const Position& pos, Move* captures, int& num_captures, Move* quiets, int& num_quiets, bool captures_only) {
-    num_captures = 0;
-    num_quiets = 0;
-
-    generate_pawn_moves(pos, captures, num_captures, quiets, num_quiets, captures_only);
+static void generate(const Position& pos, Move* captures, int& num_captures, Move* quiets, int& num_quiets, GenType type) {
+    generate_pawn_moves(pos, captures, num_captures, quiets, num_quiets, type);
 
     if (pos.side_to_move == WHITE) {
-        generate_piece_moves<WN>(pos, captures, num_captures, quiets, num_quiets, captures_only);
-        generate_piece_moves<WB>(pos, captures, num_captures, quiets, num_quiets, captures_only);
-        generate_piece_moves<WR>(pos, captures, num_captures, quiets, num_quiets, captures_only);
-        generate_piece_moves<WQ>(pos, captures, num_captures, quiets, num_quiets, captures_only);
-        generate_piece_moves<WK>(pos, captures, num_captures, quiets, num_quiets, captures_only);
+        generate_piece_moves<WN>(pos, captures, num_captures, quiets, num_quiets, type);
+        generate_piece_moves<WB>(pos, captures, num_captures, quiets, num_quiets, type);
+        generate_piece_moves<WR>(pos, captures, num_captures, quiets, num_quiets, type);
+        generate_piece_moves<WQ>(pos, captures, num_captures, quiets, num_quiets, type);
+        generate_piece_moves<WK>(pos, captures, num_captures, quiets, num_quiets, type);
     } else {
-        generate_piece_moves<BN>(pos, captures, num_captures, quiets, num_quiets, captures_only);
-        generate_piece_moves<BB>(pos, captures, num_captures, quiets, num_quiets, captures_only);
-        generate_piece_moves<BR>(pos, captures, num_captures, quiets, num_quiets, captures_only);
-        generate_piece_moves<BQ>(pos, captures, num_captures, quiets, num_quiets, captures_only);
-        generate_piece_moves<BK>(pos, captures, num_captures, quiets, num_quiets, captures_only);
+        generate_piece_moves<BN>(pos, captures, num_captures, quiets, num_quiets, type);
+        generate_piece_moves<BB>(pos, captures, num_captures, quiets, num_quiets, type);
+        generate_piece_moves<BR>(pos, captures, num_captures, quiets, num_quiets, type);
+        generate_piece_moves<BQ>(pos, captures, num_captures, quiets, num_quiets, type);
+        generate_piece_moves<BK>(pos, captures, num_captures, quiets, num_quiets, type);
     }
 
-    if (!captures_only) {
+    if (type != GEN_CAPTURES) {
         generate_castling_moves(pos, quiets, num_quiets);
     }
 }
 
+void generate_moves(const Position& pos, Move* captures, int& num_captures, Move* quiets, int& num_quiets, bool captures_only) {
+    num_captures = 0;
+    num_quiets = 0;
+    generate(pos, captures, num_captures, quiets, num_quiets, captures_only ? GEN_CAPTURES : GEN_ALL);
+}
+
+void generate_captures(const Position& pos, Move* captures, int& num_captures) {
+    int num_quiets = 0;
+    num_captures = 0;
+    generate(pos, captures, num_captures, nullptr, num_quiets, GEN_CAPTURES);
+}
+
+void generate_quiets(const Position& pos, Move* quiets, int& num_quiets) {
+    int num_captures = 0;
+    num_quiets = 0;
+    generate(pos, nullptr, num_captures, quiets, num_quiets, GEN_QUIETS);
+}
+
+// Check a move from the TT or killer table against the current position
+// without generating the full move list
+bool is_pseudo_legal(const Position& pos, Move move) {
+    if (move.value == 0) return false;
+
+    Color us = pos.side_to_move;
+    Square from = move.from();
+    Square to = move.to();
+    PieceType piece = move.moving_piece();
+    if (piece > BK || get_piece_color(piece) != us || pos.piece_on_square(from) != piece) return false;
+    if (get_bit(pos.occupancy_bitboards[us], to)) return false;
+
+    // Pawn moves and castling have too many special cases to check by hand;
+    // regenerate just those moves and look for an exact match
+    if (piece == WP || piece == BP || move.is_castling()) {
+        Move captures[MAX_CAPTURES_PER_PLY];
+        Move quiets[MAX_QUIETS_PER_PLY];
+        int num_captures = 0, num_quiets = 0;
+        if (move.is_castling()) {
+            generate_castling_moves(pos, quiets, num_quiets);
+        } else {
+            generate_pawn_moves(pos, captures, num_captures, quiets, num_quiets, GEN_ALL);
+        }
+        for (int i = 0; i < num_captures; ++i) if (captures[i] == move) return true;
+        for (int i = 0; i < num_quiets; ++i) if (quiets[i] == move) return true;
+        return false;
+    }
+
+    if (move.flags() != Move::NONE || move.promotion() != Move::NO_PROMOTION) return false;
+    if (move.captured_piece() != pos.piece_on_square(to)) return false;
+    return get_bit(get_piece_attacks(piece, from, pos.occupancy_bitboards[BOTH]), to);
+}
+
 void generate_moves(const Position& pos, Move* moves, int& num_moves, bool captures_only) {
     Move captures[256];
     Move quiets[256];
@@ -185,15 +236,81 @@ void generate_moves(const Position& pos, Move* moves, int& num_moves, bool captu
     for (int i = 0; i < num_quiets; ++i) moves[num_moves++] = quiets[i];
 }
 
-void generate_legal_moves(const Position& pos, MoveList& legal_moves) {
-    legal_moves.clear();
-    MoveList pseudo_legal_moves;
-    generate_moves(pos, pseudo_legal_moves, false);
-
-    for (const auto& move : pseudo_legal_moves) {
-        Position temp_pos = pos;
-        if (temp_pos.make_move(move)) {
-            legal_moves.push_back(move);
+// Generates pseudo-legal moves once and keeps the legal ones by testing them
+// against the checkers and pinned pieces of the position, so no move has to
+// be made on a copy of the board
+void generate_legal_moves(const Position& pos, Move* legal_moves, int& num_legal) {
+    num_legal = 0;
+
+    Color us = pos.side_to_move;
+    Color them = (us == WHITE) ? BLACK : WHITE;
+    int their_base = (them == WHITE) ? WP : BP;
+    Square king_sq = get_king_square(pos, us);
+    Bitboard occ = pos.occupancy_bitboards[BOTH];
+    Bitboard their_pieces = pos.occupancy_bitboards[them];
+    Bitboard checkers = pos.checkers;
+
+    // A piece is pinned if it is the only piece between our king and an enemy
+    // slider on the same line
+    Bitboard pinned = 0;
+    Bitboard their_queens = pos.piece_bitboards[their_base + 4];
+    Bitboard snipers = (get_bishop_attacks(king_sq, their_pieces) & (pos.piece_bitboards[their_base + 2] | their_queens))
+                     | (get_rook_attacks(king_sq, their_pieces) & (pos.piece_bitboards[their_base + 3] | their_queens));
+    while (snipers) {
+        Square sniper = pop_bit(snipers);
+        Bitboard blockers = BETWEEN_BB[king_sq][sniper] & occ;
+        if (blockers && !(blockers & (blockers - 1))) {
+            pinned |= blockers & pos.occupancy_bitboards[us];
+        }
+    }
+
+    // Non-king moves must capture or block a single checker; in double check
+    // only the king may move
+    Bitboard evasion_mask = ~0ULL;
+    if (checkers) {
+        evasion_mask = (checkers & (checkers - 1)) ? 0 : (checkers | BETWEEN_BB[king_sq][lsb_index(checkers)]);
+    }
+
+    Move captures[MAX_MOVES_PER_PLY];
+    Move quiets[MAX_MOVES_PER_PLY];
+    int num_captures = 0, num_quiets = 0;
+    generate(pos, captures, num_captures, quiets, num_quiets, GEN_ALL);
+
+    auto is_legal = [&](Move move) {
+        Square from = move.from();
+        Square to = move.to();
+        Bitboard to_bb = 1ULL << to;
+
+        if (from == king_sq) {
+            // Castling is only generated when the king's path is safe
+            if (move.is_castling()) return true;
+            return !(pos.attackers_to(to, occ ^ (1ULL << king_sq)) & their_pieces);
+        }
+
+        // En passant removes two pieces from a line at once, so test the
+        // resulting occupancy directly
+        if (move.is_en_passant()) {
+            Square captured_sq = static_cast<Square>(to + (us == WHITE ? -8 : 8));
+            Bitboard after = (occ ^ (1ULL << from) ^ (1ULL << captured_sq)) | to_bb;
+            return !(pos.attackers_to(king_sq, after) & their_pieces & ~(1ULL << captured_sq));
         }
+
+        if (!(to_bb & evasion_mask)) return false;
+        if (pinned & (1ULL << from)) return (LINE_BB[king_sq][from] & to_bb) != 0;
+        return true;
+    };
+
+    for (int i = 0; i < num_captures; ++i) {
+        if (is_legal(captures[i])) legal_moves[num_legal++] = captures[i];
+    }
+    for (int i = 0; i < num_quiets; ++i) {
+        if (is_legal(quiets[i])) legal_moves[num_legal++] = quiets[i];
     }
 }
+
+void generate_legal_moves(const Position& pos, MoveList& legal_moves) {
+    Move moves[MAX_MOVES_PER_PLY];
+    int num_moves = 0;
+    generate_legal_moves(pos, moves, num_moves);
+    legal_moves.assign(moves, moves + num_moves);
+}
@@ -19,5 +19,15 @@ void generate_moves(const Position& pos, Move* captures, int& num_captures, Move
 void generate_moves(const Position& pos, Move* moves, int& num_moves, bool captures_only = false);
 void generate_moves(const Position& pos, MoveList& moves, bool captures_only = false);
 void generate_legal_moves(const Position& pos, MoveList& legal_moves);
+void generate_legal_moves(const Position& pos, Move* legal_moves, int& num_legal);
+
+// Staged generation for the move picker: captures (including capture
+// promotions and en passant) and quiet moves (including push promotions and
+// castling) separately
+void generate_captures(const Position& pos, Move* captures, int& num_captures);
+void generate_quiets(const Position& pos, Move* quiets, int& num_quiets);
+
+// True if `move` could have been generated in `pos` (ignores king safety)
+bool is_pseudo_legal(const Position& pos, Move move);
 
 #endif // MOVEGEN_H
\ No newline at end of file
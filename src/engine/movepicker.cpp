@@ -0,0 +1,128 @@
+#include "movepicker.h"
+#include "position.h"
+#include "attack.h"
+#include <cstdlib>
+
+MovePicker::MovePicker(const Position& pos, Move tt_move, const Move* killers, const int (*history)[64])
+    : pos(pos), tt_move(tt_move), history(history) {
+    this->killers[0] = killers[0];
+    this->killers[1] = killers[1];
+    stage = is_pseudo_legal(pos, tt_move) ? STAGE_TT_MOVE : STAGE_INIT_CAPTURES;
+}
+
+MovePicker::MovePicker(const Position& pos)
+    : pos(pos), tt_move(Move(0)), history(nullptr), stage(STAGE_QS_INIT_CAPTURES) {
+    killers[0] = killers[1] = Move(0);
+}
+
+// MVV-LVA: most valuable victim first, cheapest attacker breaks ties
+void MovePicker::score_captures() {
+    for (int i = 0; i < num_captures; ++i) {
+        Move m = captures[i];
+        capture_scores[i] = SEE_VALUES[m.captured_piece()] * 8 - SEE_VALUES[m.moving_piece()] / 100;
+        if (m.is_promotion()) capture_scores[i] += 800;
+    }
+}
+
+// --- Policy Score ---
+// Static bonus for quiet moves: promotions first, then central destinations
+int policy_score(Move m) {
+    if (m.is_capture()) return 0;
+    if (m.is_promotion()) return 50;
+    Square to = m.to();
+    int file = get_file(to);
+    int rank = get_rank(to);
+    int center = 4 - std::abs(file - 3) - std::abs(rank - 3);
+    return center;
+}
+
+void MovePicker::score_quiets() {
+    for (int i = 0; i < num_quiets; ++i) {
+        Move m = quiets[i];
+        quiet_scores[i] = history[m.moving_piece()][m.to()] + policy_score(m);
+    }
+}
+
+// Moves already returned by an earlier stage
+bool MovePicker::is_special(Move move) const {
+    return move == tt_move || move == killers[0] || move == killers[1];
+}
+
+Move MovePicker::next_move() {
+    switch (stage) {
+    case STAGE_TT_MOVE:
+        ++stage;
+        return tt_move;
+
+    case STAGE_INIT_CAPTURES:
+        generate_captures(pos, captures, num_captures);
+        score_captures();
+        ++stage;
+        [[fallthrough]];
+
+    case STAGE_GOOD_CAPTURES:
+        while (capture_index < num_captures) {
+            Move m = pick_best(captures, capture_scores, capture_index++, num_captures);
+            if (m == tt_move) continue;
+            // SEE only for the capture we are about to try
+            if (see(pos, m) < 0) {
+                bad_captures[num_bad_captures++] = m;
+                continue;
+            }
+            return m;
+        }
+        ++stage;
+        [[fallthrough]];
+
+    case STAGE_KILLER_1:
+        ++stage;
+        if (killers[0] != tt_move && !killers[0].is_capture() && is_pseudo_legal(pos, killers[0])) {
+            return killers[0];
+        }
+        [[fallthrough]];
+
+    case STAGE_KILLER_2:
+        ++stage;
+        if (killers[1] != tt_move && killers[1] != killers[0] && !killers[1].is_capture() && is_pseudo_legal(pos, killers[1])) {
+            return killers[1];
+        }
+        [[fallthrough]];
+
+    case STAGE_INIT_QUIETS:
+        generate_quiets(pos, quiets, num_quiets);
+        score_quiets();
+        ++stage;
+        [[fallthrough]];
+
+    case STAGE_QUIETS:
+        while (quiet_index < num_quiets) {
+            Move m = pick_best(quiets, quiet_scores, quiet_index++, num_quiets);
+            if (!is_special(m)) return m;
+        }
+        ++stage;
+        [[fallthrough]];
+
+    case STAGE_BAD_CAPTURES:
+        if (bad_capture_index < num_bad_captures) {
+            return bad_captures[bad_capture_index++];
+        }
+        stage = STAGE_DONE;
+        return Move(0);
+
+    case STAGE_QS_INIT_CAPTURES:
+        generate_captures(pos, captures, num_captures);
+        score_captures();
+        ++stage;
+        [[fallthrough]];
+
+    case STAGE_QS_CAPTURES:
+        if (capture_index < num_captures) {
+            return pick_best(captures, capture_scores, capture_index++, num_captures);
+        }
+        stage = STAGE_DONE;
+        return Move(0);
+
+    default:
+        return Move(0);
+    }
+}
@@ -0,0 +1,74 @@
+#ifndef MOVEPICKER_H
+#define MOVEPICKER_H
+
+#include "types.h"
+#include "movegen.h"
+#include <utility>
+
+class Position;
+
+// Staged move picker
+// Hands out moves one at a time in search order: TT move, winning and equal
+// captures, killers, quiets by history, then losing captures. Each stage is
+// only generated and scored when the previous ones failed to produce a
+// cutoff, and moves are picked by partial selection sort instead of sorting
+// whole lists up front.
+class MovePicker {
+public:
+    // Main search: all moves
+    MovePicker(const Position& pos, Move tt_move, const Move* killers, const int (*history)[64]);
+    // Quiescence search: captures only, best victim first
+    explicit MovePicker(const Position& pos);
+
+    // Next pseudo-legal move, or Move(0) when exhausted
+    Move next_move();
+
+private:
+    enum Stage {
+        STAGE_TT_MOVE, STAGE_INIT_CAPTURES, STAGE_GOOD_CAPTURES, STAGE_KILLER_1, STAGE_KILLER_2,
+        STAGE_INIT_QUIETS, STAGE_QUIETS, STAGE_BAD_CAPTURES,
+        STAGE_QS_INIT_CAPTURES, STAGE_QS_CAPTURES,
+        STAGE_DONE
+    };
+
+    const Position& pos;
+    Move tt_move;
+    Move killers[2];
+    const int (*history)[64];
+    int stage;
+
+    Move captures[MAX_CAPTURES_PER_PLY];
+    int capture_scores[MAX_CAPTURES_PER_PLY];
+    int num_captures = 0;
+    int capture_index = 0;
+
+    // Losing captures are parked here during STAGE_GOOD_CAPTURES
+    Move bad_captures[MAX_CAPTURES_PER_PLY];
+    int num_bad_captures = 0;
+    int bad_capture_index = 0;
+
+    // Sized for a whole move list: some legal positions have over 200 quiets
+    Move quiets[MAX_MOVES_PER_PLY];
+    int quiet_scores[MAX_MOVES_PER_PLY];
+    int num_quiets = 0;
+    int quiet_index = 0;
+
+    void score_captures();
+    void score_quiets();
+    bool is_special(Move move) const;
+};
+
+int policy_score(Move m);
+
+// Pick the highest-scored move in [begin, end) and swap it to `begin`
+inline Move pick_best(Move* moves, int* scores, int begin, int end) {
+    int best = begin;
+    for (int i = begin + 1; i < end; ++i) {
+        if (scores[i] > scores[best]) best = i;
+    }
+    std::swap(moves[begin], moves[best]);
+    std::swap(scores[begin], scores[best]);
+    return moves[begin];
+}
+
+#endif // MOVEPICKER_H
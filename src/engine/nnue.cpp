@@ -2,13 +2,169 @@
 #include "move.h"
 #include <iostream>
 #include <fstream>
-#include <vector>
+#include <cstring>
+#include <algorithm>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#include <immintrin.h>
+#define NNUE_X86 1
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#define NNUE_NEON 1
+#endif
 
 namespace NNUE {
 
-Evaluator nnue_evaluator;
+Network network;
+thread_local Evaluator nnue_evaluator;
 bool nnue_available = false;
 
+// --- Vector Kernels ---
+// The accumulator and a weight row are HIDDEN_SIZE int16 values, so every
+// kernel walks whole registers with no tail. The x86 variants are compiled
+// with per-function target attributes and chosen once at startup, so the
+// same binary runs on CPUs with or without AVX2.
+
+struct Kernels {
+    void (*add)(int16_t* acc, const int16_t* weights);
+    void (*sub)(int16_t* acc, const int16_t* weights);
+    int32_t (*dot)(const int16_t* acc, const int16_t* weights); // sum(clamp(acc) * weights)
+    const char* name;
+};
+
+#if defined(NNUE_X86)
+__attribute__((target("avx2")))
+static void add_avx2(int16_t* acc, const int16_t* weights) {
+    for (int i = 0; i < HIDDEN_SIZE; i += 16) {
+        __m256i a = _mm256_load_si256(reinterpret_cast<const __m256i*>(acc + i));
+        __m256i w = _mm256_load_si256(reinterpret_cast<const __m256i*>(weights + i));
+        _mm256_store_si256(reinterpret_cast<__m256i*>(acc + i), _mm256_add_epi16(a, w));
+    }
+}
+
+__attribute__((target("avx2")))
+static void sub_avx2(int16_t* acc, const int16_t* weights) {
+    for (int i = 0; i < HIDDEN_SIZE; i += 16) {
+        __m256i a = _mm256_load_si256(reinterpret_cast<const __m256i*>(acc + i));
+        __m256i w = _mm256_load_si256(reinterpret_cast<const __m256i*>(weights + i));
+        _mm256_store_si256(reinterpret_cast<__m256i*>(acc + i), _mm256_sub_epi16(a, w));
+    }
+}
+
+__attribute__((target("avx2")))
+static int32_t dot_avx2(const int16_t* acc, const int16_t* weights) {
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i clip = _mm256_set1_epi16(ACTIVATION_CLIP);
+    __m256i sum = _mm256_setzero_si256();
+    for (int i = 0; i < HIDDEN_SIZE; i += 16) {
+        __m256i a = _mm256_load_si256(reinterpret_cast<const __m256i*>(acc + i));
+        __m256i w = _mm256_load_si256(reinterpret_cast<const __m256i*>(weights + i));
+        a = _mm256_min_epi16(_mm256_max_epi16(a, zero), clip);
+        sum = _mm256_add_epi32(sum, _mm256_madd_epi16(a, w));
+    }
+    __m128i s = _mm_add_epi32(_mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1));
+    s = _mm_add_epi32(s, _mm_shuffle_epi32(s, 0x4E));
+    s = _mm_add_epi32(s, _mm_shuffle_epi32(s, 0xB1));
+    return _mm_cvtsi128_si32(s);
+}
+
+// SSE2 is part of the x86-64 baseline, so this is the fallback on every x86 CPU
+static void add_sse2(int16_t* acc, const int16_t* weights) {
+    for (int i = 0; i < HIDDEN_SIZE; i += 8) {
+        __m128i a = _mm_load_si128(reinterpret_cast<const __m128i*>(acc + i));
+        __m128i w = _mm_load_si128(reinterpret_cast<const __m128i*>(weights + i));
+        _mm_store_si128(reinterpret_cast<__m128i*>(acc + i), _mm_add_epi16(a, w));
+    }
+}
+
+static void sub_sse2(int16_t* acc, const int16_t* weights) {
+    for (int i = 0; i < HIDDEN_SIZE; i += 8) {
+        __m128i a = _mm_load_si128(reinterpret_cast<const __m128i*>(acc + i));
+        __m128i w = _mm_load_si128(reinterpret_cast<const __m128i*>(weights + i));
+        _mm_store_si128(reinterpret_cast<__m128i*>(acc + i), _mm_sub_epi16(a, w));
+    }
+}
+
+static int32_t dot_sse2(const int16_t* acc, const int16_t* weights) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i clip = _mm_set1_epi16(ACTIVATION_CLIP);
+    __m128i sum = _mm_setzero_si128();
+    for (int i = 0; i < HIDDEN_SIZE; i += 8) {
+        __m128i a = _mm_load_si128(reinterpret_cast<const __m128i*>(acc + i));
+        __m128i w = _mm_load_si128(reinterpret_cast<const __m128i*>(weights + i));
+        a = _mm_min_epi16(_mm_max_epi16(a, zero), clip);
+        sum = _mm_add_epi32(sum, _mm_madd_epi16(a, w));
+    }
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0x4E));
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0xB1));
+    return _mm_cvtsi128_si32(sum);
+}
+#elif defined(NNUE_NEON)
+static void add_neon(int16_t* acc, const int16_t* weights) {
+    for (int i = 0; i < HIDDEN_SIZE; i += 8) {
+        vst1q_s16(acc + i, vaddq_s16(vld1q_s16(acc + i), vld1q_s16(weights + i)));
+    }
+}
+
+static void sub_neon(int16_t* acc, const int16_t* weights) {
+    for (int i = 0; i < HIDDEN_SIZE; i += 8) {
+        vst1q_s16(acc + i, vsubq_s16(vld1q_s16(acc + i), vld1q_s16(weights + i)));
+    }
+}
+
+static int32_t dot_neon(const int16_t* acc, const int16_t* weights) {
+    const int16x8_t zero = vdupq_n_s16(0);
+    const int16x8_t clip = vdupq_n_s16(ACTIVATION_CLIP);
+    int32x4_t sum = vdupq_n_s32(0);
+    for (int i = 0; i < HIDDEN_SIZE; i += 8) {
+        int16x8_t a = vminq_s16(vmaxq_s16(vld1q_s16(acc + i), zero), clip);
+        int16x8_t w = vld1q_s16(weights + i);
+        sum = vmlal_s16(sum, vget_low_s16(a), vget_low_s16(w));
+        sum = vmlal_s16(sum, vget_high_s16(a), vget_high_s16(w));
+    }
+    return vaddvq_s32(sum);
+}
+#else
+static void add_scalar(int16_t* acc, const int16_t* weights) {
+    for (int i = 0; i < HIDDEN_SIZE; ++i) acc[i] += weights[i];
+}
+
+static void sub_scalar(int16_t* acc, const int16_t* weights) {
+    for (int i = 0; i < HIDDEN_SIZE; ++i) acc[i] -= weights[i];
+}
+
+static int32_t dot_scalar(const int16_t* acc, const int16_t* weights) {
+    int32_t sum = 0;
+    for (int i = 0; i < HIDDEN_SIZE; ++i) {
+        int32_t hidden = std::min<int32_t>(std::max<int32_t>(acc[i], 0), ACTIVATION_CLIP);
+        sum += hidden * weights[i];
+    }
+    return sum;
+}
+#endif
+
+static Kernels select_kernels() {
+#if defined(NNUE_X86)
+#if defined(__GNUC__) || defined(__clang__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return {add_avx2, sub_avx2, dot_avx2, "avx2"};
+    }
+#endif
+    return {add_sse2, sub_sse2, dot_sse2, "sse2"};
+#elif defined(NNUE_NEON)
+    return {add_neon, sub_neon, dot_neon, "neon"};
+#else
+    return {add_scalar, sub_scalar, dot_scalar, "scalar"};
+#endif
+}
+
+static const Kernels KERNELS = select_kernels();
+
+const char* simd_kernel_name() {
+    return KERNELS.name;
+}
+
 // --- Feature Transformer ---
 // Simple halfkp: 12 pieces * 64 squares = 768 features
 int Evaluator::get_feature_index(PieceType pt, Square sq) {
@@ -17,13 +173,12 @@ int Evaluator::get_feature_index(PieceType pt, Square sq) {
 
 // --- Evaluator Class Implementation ---
 
-Evaluator::Evaluator() : initialized(false) {}
+Evaluator::Evaluator() {}
 
 bool Evaluator::init(const char* path) {
     std::ifstream file(path, std::ios::binary);
     if (!file) {
         std::cout << "info string NNUE: file not found: " << path << std::endl;
-        initialized = false;
         nnue_available = false;
         return false;
     }
@@ -33,7 +188,6 @@ bool Evaluator::init(const char* path) {
     file.read(magic, 8);
     if (std::string(magic) != "CWNNUEv1") {
         std::cout << "info string NNUE: invalid magic header." << std::endl;
-        initialized = false;
         nnue_available = false;
         return false;
     }
@@ -45,7 +199,6 @@ bool Evaluator::init(const char* path) {
 
     if (input_size != INPUT_SIZE || hidden_size != HIDDEN_SIZE || output_size != 1) {
         std::cout << "info string NNUE: network size mismatch." << std::endl;
-        initialized = false;
         nnue_available = false;
         return false;
     }
@@ -54,21 +207,13 @@ bool Evaluator::init(const char* path) {
     int32_t quant_params;
     file.read(reinterpret_cast<char*>(&quant_params), sizeof(int32_t));
 
-    // Read weights as int16_t, convert to int32_t
-    std::vector<int16_t> temp_feature_weights(INPUT_SIZE * HIDDEN_SIZE);
-    std::vector<int16_t> temp_feature_bias(HIDDEN_SIZE);
-    std::vector<int16_t> temp_output_weights(HIDDEN_SIZE);
-    int16_t temp_output_bias;
-
-    file.read(reinterpret_cast<char*>(temp_feature_weights.data()), INPUT_SIZE * HIDDEN_SIZE * sizeof(int16_t));
-    file.read(reinterpret_cast<char*>(temp_feature_bias.data()), HIDDEN_SIZE * sizeof(int16_t));
-    file.read(reinterpret_cast<char*>(temp_output_weights.data()), HIDDEN_SIZE * sizeof(int16_t));
-    file.read(reinterpret_cast<char*>(&temp_output_bias), sizeof(int16_t));
-
-    net.feature_weights.assign(temp_feature_weights.begin(), temp_feature_weights.end());
-    net.feature_bias.assign(temp_feature_bias.begin(), temp_feature_bias.end());
-    net.output_weights.assign(temp_output_weights.begin(), temp_output_weights.end());
-    net.output_bias = temp_output_bias;
+    // Weights are stored as int16 in the file and kept that way in memory
+    int16_t output_bias;
+    file.read(reinterpret_cast<char*>(network.feature_weights), sizeof(network.feature_weights));
+    file.read(reinterpret_cast<char*>(network.feature_bias), sizeof(network.feature_bias));
+    file.read(reinterpret_cast<char*>(network.output_weights), sizeof(network.output_weights));
+    file.read(reinterpret_cast<char*>(&output_bias), sizeof(int16_t));
+    network.output_bias = output_bias;
 
     // Skip checksum for now
     uint32_t checksum;
@@ -76,121 +221,141 @@ bool Evaluator::init(const char* path) {
 
     if (!file) {
         std::cout << "info string NNUE: error reading file." << std::endl;
-        initialized = false;
         nnue_available = false;
         return false;
     }
 
-    initialized = true;
     nnue_available = true;
-    std::cout << "info string NNUE: network loaded successfully." << std::endl;
+    std::cout << "info string NNUE: network loaded successfully (" << KERNELS.name << " kernels)." << std::endl;
     return true;
 }
 
 void Evaluator::reset(const Position& pos) {
-    if (!initialized) return;
+    if (!nnue_available) return;
 
-    acc.hidden.assign(net.feature_bias.begin(), net.feature_bias.end());
+    top = 0;
+    refresh(stack[0], pos);
+}
+
+void Evaluator::refresh(Accumulator& acc, const Position& pos) {
+    std::memcpy(acc.hidden, network.feature_bias, sizeof(acc.hidden));
 
     for (int pt_idx = 0; pt_idx < 12; ++pt_idx) {
         Bitboard bb = pos.piece_bitboards[pt_idx];
         while (bb) {
             Square sq = pop_bit(bb);
-            update_feature(get_feature_index(static_cast<PieceType>(pt_idx), sq), true);
+            update_feature(acc, get_feature_index(static_cast<PieceType>(pt_idx), sq), true);
         }
     }
+    acc.computed = true;
 }
 
-void Evaluator::update_feature(int feature_index, bool add) {
+void Evaluator::update_feature(Accumulator& acc, int feature_index, bool add) {
+    const int16_t* weights = &network.feature_weights[feature_index * HIDDEN_SIZE];
     if (add) {
-        for (int i = 0; i < HIDDEN_SIZE; ++i) {
-            acc.hidden[i] += net.feature_weights[feature_index * HIDDEN_SIZE + i];
-        }
+        KERNELS.add(acc.hidden, weights);
     } else {
-        for (int i = 0; i < HIDDEN_SIZE; ++i) {
-            acc.hidden[i] -= net.feature_weights[feature_index * HIDDEN_SIZE + i];
-        }
+        KERNELS.sub(acc.hidden, weights);
+    }
+}
+
+Accumulator& Evaluator::push() {
+    Accumulator& acc = stack[++top];
+    acc.computed = false;
+    acc.num_added = 0;
+    acc.num_removed = 0;
+    return acc;
+}
+
+// Bring stack[top] up to date: replay pending plies from the nearest computed
+// ancestor, or rebuild from the board when that chain is too long
+void Evaluator::materialize(const Position& pos) {
+    int base = top;
+    while (base > 0 && !stack[base].computed) --base;
+
+    if (!stack[base].computed || top - base > LAZY_REFRESH_LIMIT) {
+        refresh(stack[top], pos);
+        return;
+    }
+
+    for (int i = base + 1; i <= top; ++i) {
+        Accumulator& acc = stack[i];
+        std::memcpy(acc.hidden, stack[i - 1].hidden, sizeof(acc.hidden));
+        for (int j = 0; j < acc.num_removed; ++j) update_feature(acc, acc.removed[j], false);
+        for (int j = 0; j < acc.num_added; ++j) update_feature(acc, acc.added[j], true);
+        acc.computed = true;
     }
 }
 
 void Evaluator::update_make(const Position& pos, Move move) {
-    if (!initialized) return;
+    if (!nnue_available) return;
 
-    acc.deltas.clear();
-    std::vector<int> toggled;
+    Accumulator& acc = push();
 
     PieceType moved_piece = move.moving_piece();
     PieceType captured_piece = move.captured_piece();
+    Color us = get_piece_color(moved_piece);
     Square from = move.from();
     Square to = move.to();
 
-    // Collect toggled features
     // Remove moved piece from original square
-    toggled.push_back(get_feature_index(moved_piece, from));
+    acc.removed[acc.num_removed++] = get_feature_index(moved_piece, from);
 
     // Remove captured piece
     if (captured_piece != NO_PIECE) {
         Square captured_sq = to;
         if (move.is_en_passant()) {
-            captured_sq = (get_piece_color(moved_piece) == WHITE) ? static_cast<Square>(to - 8) : static_cast<Square>(to + 8);
+            captured_sq = (us == WHITE) ? static_cast<Square>(to - 8) : static_cast<Square>(to + 8);
         }
-        toggled.push_back(get_feature_index(captured_piece, captured_sq));
+        acc.removed[acc.num_removed++] = get_feature_index(captured_piece, captured_sq);
     }
 
     // Add moved piece to new square
     if (move.is_promotion()) {
-        PieceType promoted_piece = promotion_val_to_piece_type(move.promotion(), get_piece_color(moved_piece));
-        toggled.push_back(get_feature_index(promoted_piece, to));
+        PieceType promoted_piece = promotion_val_to_piece_type(move.promotion(), us);
+        acc.added[acc.num_added++] = get_feature_index(promoted_piece, to);
     } else {
-        toggled.push_back(get_feature_index(moved_piece, to));
+        acc.added[acc.num_added++] = get_feature_index(moved_piece, to);
     }
 
-    // Update accumulator
-    for (int f : toggled) {
-        update_feature(f, true);
+    // Castling also moves the rook
+    if (move.is_castling()) {
+        PieceType rook = (us == WHITE) ? WR : BR;
+        bool kingside = get_file(to) == FILE_G;
+        Square rook_from = static_cast<Square>(kingside ? to + 1 : to - 2);
+        Square rook_to = static_cast<Square>(kingside ? to - 1 : to + 1);
+        acc.removed[acc.num_removed++] = get_feature_index(rook, rook_from);
+        acc.added[acc.num_added++] = get_feature_index(rook, rook_to);
     }
-
-    acc.deltas = toggled;
 }
 
 void Evaluator::update_unmake(const Position& pos, Move move) {
-    if (!initialized) return;
-
-    // Undo the updates
-    for (int f : acc.deltas) {
-        update_feature(f, false);
-    }
-    acc.deltas.clear();
+    if (!nnue_available) return;
+    --top;
 }
 
+// A null move changes no features: push an empty pending entry
 void Evaluator::update_make_null() {
-    if (!initialized) return;
-    // Stub: A real implementation would need to handle the side-to-move change efficiently.
+    if (!nnue_available) return;
+    push();
 }
 
 void Evaluator::update_unmake_null() {
-    if (!initialized) return;
-    // Stub: A real implementation would need to handle the side-to-move change efficiently.
+    if (!nnue_available) return;
+    --top;
 }
 
-// ReLU activation function
-inline int32_t relu(int32_t x) {
-    return std::max(0, x);
-}
+int32_t Evaluator::evaluate(const Position& pos) {
+    if (!nnue_available) return 0;
 
-int32_t Evaluator::evaluate(Color us) {
-    if (!initialized) return 0;
+    if (!stack[top].computed) materialize(pos);
 
-    int32_t score = net.output_bias;
-    for (int i = 0; i < HIDDEN_SIZE; ++i) {
-        int32_t hidden = std::max(0, acc.hidden[i]);
-        score += hidden * net.output_weights[i];
-    }
+    int32_t score = network.output_bias + KERNELS.dot(stack[top].hidden, network.output_weights);
 
     // Scale by 16 as per common NNUE implementations
     score /= 16;
 
-    return (us == WHITE) ? score : -score;
+    return (pos.side_to_move == WHITE) ? score : -score;
 }
 
 } // namespace NNUE
\ No newline at end of file
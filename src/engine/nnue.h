@@ -2,7 +2,6 @@
 
 #include "types.h"
 #include "position.h"
-#include <vector>
 
 namespace NNUE {
 
@@ -10,23 +9,39 @@ namespace NNUE {
 const int INPUT_SIZE = 768;
 const int HIDDEN_SIZE = 256;
 
+// Clipped ReLU ceiling applied to the accumulator before the output layer
+const int ACTIVATION_CLIP = 255;
+
 // NNUE Network Weights and Biases
+// Weights stay in the file's int16 format, aligned for the SIMD kernels
 struct Network {
     // Input to hidden layer
-    std::vector<int32_t> feature_weights; // size = INPUT_SIZE * HIDDEN_SIZE
-    std::vector<int32_t> feature_bias;    // size = HIDDEN_SIZE
+    alignas(64) int16_t feature_weights[INPUT_SIZE * HIDDEN_SIZE];
+    alignas(64) int16_t feature_bias[HIDDEN_SIZE];
 
     // Hidden to output layer
-    std::vector<int32_t> output_weights;  // size = HIDDEN_SIZE
+    alignas(64) int16_t output_weights[HIDDEN_SIZE];
     int32_t output_bias;
 };
 
 // Accumulator for incremental updates
+// `hidden` is only valid when `computed` is set; otherwise the entry holds the
+// features its move toggled relative to the entry below it
 struct Accumulator {
-    std::vector<int32_t> hidden; // size = HIDDEN_SIZE
-    std::vector<int> deltas; // for nnue_delta_indices
+    alignas(64) int16_t hidden[HIDDEN_SIZE];
+    bool computed;
+    int num_added, num_removed;
+    int added[2], removed[2];
 };
 
+// One accumulator per search ply: make records the move's feature changes,
+// unmake just pops, so nested make/unmake never needs to undo anything
+const int ACC_STACK_SIZE = MAX_PLY + 1;
+
+// Longest chain of pending plies worth replaying; past this a full refresh
+// from the board is cheaper
+const int LAZY_REFRESH_LIMIT = 8;
+
 // Main NNUE evaluation class
 class Evaluator {
 public:
@@ -37,19 +52,27 @@ public:
     void update_unmake(const Position& pos, Move move);
     void update_make_null();
     void update_unmake_null();
-    int32_t evaluate(Color us);
+    int32_t evaluate(const Position& pos);
 
 private:
-    Network net;
-    Accumulator acc;
-    bool initialized = false;
+    Accumulator stack[ACC_STACK_SIZE];
+    int top = 0;
 
-    void update_feature(int feature_index, bool add);
+    Accumulator& push();
+    void refresh(Accumulator& acc, const Position& pos);
+    void materialize(const Position& pos);
+    void update_feature(Accumulator& acc, int feature_index, bool add);
     int get_feature_index(PieceType pt, Square sq);
 };
 
-// Global NNUE evaluator instance
-extern Evaluator nnue_evaluator;
+// Network weights are loaded once and shared by every search thread
+extern Network network;
+
+// Each search thread keeps its own accumulator
+extern thread_local Evaluator nnue_evaluator;
 extern bool nnue_available;
 
+// Name of the vector kernel set picked for this CPU ("avx2", "sse2", "neon" or "scalar")
+const char* simd_kernel_name();
+
 } // namespace NNUE
\ No newline at end of file
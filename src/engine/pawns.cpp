@@ -0,0 +1,113 @@
+#include "pawns.h"
+#include "position.h"
+#include "attack.h"
+#include <algorithm>
+#include <memory>
+
+// --- Pawn Structure Weights (midgame, endgame) ---
+const int PASSED_MG[8] = {0, 5, 10, 15, 25, 40, 60, 0}; // By relative rank
+const int PASSED_EG[8] = {0, 10, 15, 25, 45, 70, 100, 0};
+const int DOUBLED_MG = -10, DOUBLED_EG = -20;
+const int ISOLATED_MG = -10, ISOLATED_EG = -15;
+const int BACKWARD_MG = -8, BACKWARD_EG = -10;
+
+// Shelter penalty by the relative rank of the own pawn nearest the back rank
+// on a file next to the king; index 0 means the file has no own pawn
+const int SHELTER[8] = {-30, 0, -10, -20, -25, -25, -25, -25};
+
+static Bitboard file_bb(int file) {
+    return FILE_A_BB << file;
+}
+
+static Bitboard adjacent_files_bb(int file) {
+    return (file > 0 ? file_bb(file - 1) : 0) | (file < 7 ? file_bb(file + 1) : 0);
+}
+
+// Squares on the ranks in front of `sq` as seen by `c`
+static Bitboard forward_ranks_bb(Color c, Square sq) {
+    int rank = rank_of(sq);
+    if (c == WHITE) return rank == 7 ? 0 : ~0ULL << (8 * (rank + 1));
+    return (1ULL << (8 * rank)) - 1;
+}
+
+static int relative_rank(Color c, Square sq) {
+    return c == WHITE ? rank_of(sq) : 7 - rank_of(sq);
+}
+
+static void evaluate_pawns(Color c, Bitboard own, Bitboard their, int& mg, int& eg) {
+    Bitboard bb = own;
+    while (bb) {
+        Square sq = pop_bit(bb);
+        int file = file_of(sq);
+        Bitboard forward = forward_ranks_bb(c, sq);
+        Bitboard adjacent = adjacent_files_bb(file);
+
+        if (!(their & (file_bb(file) | adjacent) & forward)) {
+            mg += PASSED_MG[relative_rank(c, sq)];
+            eg += PASSED_EG[relative_rank(c, sq)];
+        }
+
+        // Only the rear pawn of a doubled pair is penalized
+        if (own & file_bb(file) & forward) {
+            mg += DOUBLED_MG;
+            eg += DOUBLED_EG;
+        }
+
+        if (!(own & adjacent)) {
+            mg += ISOLATED_MG;
+            eg += ISOLATED_EG;
+        } else if (!(own & adjacent & ~forward)) {
+            // No neighbour level with or behind it to support its advance,
+            // and an enemy pawn guards the square in front
+            Square stop = (Square)(c == WHITE ? sq + 8 : sq - 8);
+            if (PAWN_ATTACKS[c][stop] & their) {
+                mg += BACKWARD_MG;
+                eg += BACKWARD_EG;
+            }
+        }
+    }
+}
+
+// Shelter of a king on each file: the three files around it, with an edge
+// king counted like one on the b or g file
+static void shelter_scores(Color c, Bitboard own, int8_t* out) {
+    int file_score[8];
+    for (int file = 0; file < 8; ++file) {
+        Bitboard pawns = own & file_bb(file);
+        if (!pawns) {
+            file_score[file] = SHELTER[0];
+            continue;
+        }
+        Square nearest = (Square)(c == WHITE ? lsb_index(pawns) : 63 - __builtin_clzll(pawns));
+        file_score[file] = SHELTER[relative_rank(c, nearest)];
+    }
+    for (int file = 0; file < 8; ++file) {
+        int center = std::clamp(file, 1, 6);
+        out[file] = (int8_t)(file_score[center - 1] + file_score[center] + file_score[center + 1]);
+    }
+}
+
+PawnTable::PawnTable() : entries(new PawnEntry[PAWN_TABLE_SIZE]) {
+    // No pawn key is all ones in practice, so fresh entries never match
+    for (size_t i = 0; i < PAWN_TABLE_SIZE; ++i) entries[i].key = ~0ULL;
+}
+
+const PawnEntry& PawnTable::probe(const Position& pos) {
+    PawnEntry& e = entries[pos.pawn_key & (PAWN_TABLE_SIZE - 1)];
+    if (e.key == pos.pawn_key) {
+        return e;
+    }
+
+    Bitboard white = pos.piece_bitboards[WP];
+    Bitboard black = pos.piece_bitboards[BP];
+    int w_mg = 0, w_eg = 0, b_mg = 0, b_eg = 0;
+    evaluate_pawns(WHITE, white, black, w_mg, w_eg);
+    evaluate_pawns(BLACK, black, white, b_mg, b_eg);
+
+    e.key = pos.pawn_key;
+    e.score_mg = (int16_t)(w_mg - b_mg);
+    e.score_eg = (int16_t)(w_eg - b_eg);
+    shelter_scores(WHITE, white, e.shelter[WHITE]);
+    shelter_scores(BLACK, black, e.shelter[BLACK]);
+    return e;
+}
@@ -0,0 +1,39 @@
+#ifndef PAWNS_H
+#define PAWNS_H
+
+#include "types.h"
+#include "bitboard.h"
+#include <cstddef>
+#include <memory>
+
+class Position;
+
+// Pawn-structure terms depend only on where the pawns stand, and the pawn
+// structure changes far less often than the full position. They are cached
+// by Position::pawn_key so each structure is scored once and then reused.
+struct PawnEntry {
+    uint64_t key;
+    int16_t score_mg; // Passed, isolated, doubled and backward pawns, White's view
+    int16_t score_eg;
+    int8_t shelter[2][8]; // Pawn shelter (midgame) for a king of each color on each file
+    uint8_t padding[4]; // Padding to 32 bytes
+};
+
+// Entries in each thread's pawn table (a power of two)
+const size_t PAWN_TABLE_SIZE = 16384;
+
+// Pawn structure cache of one search thread, so no locking is needed. The
+// scores depend on nothing but the pawns, so a table stays valid from one
+// search to the next and is kept for the life of its thread's state.
+class PawnTable {
+public:
+    PawnTable();
+
+    // Entry for the position's pawn structure, computed on a miss
+    const PawnEntry& probe(const Position& pos);
+
+private:
+    std::unique_ptr<PawnEntry[]> entries;
+};
+
+#endif // PAWNS_H
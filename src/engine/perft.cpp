@@ -0,0 +1,200 @@
+#include "perft.h"
+#include "movegen.h"
+#include "move.h"
+#include <iostream>
+#include <vector>
+#include <atomic>
+#include <thread>
+#include <memory>
+#include <chrono>
+#include <algorithm>
+
+// --- Perft Cache ---
+// One entry per slot, verified the same way as the main TT: `check` holds
+// key ^ depth salt ^ nodes, so a torn write from another thread simply fails
+// to match and is treated as a miss.
+struct PerftEntry {
+    std::atomic<uint64_t> check;
+    std::atomic<uint64_t> nodes;
+};
+
+class PerftCache {
+public:
+    explicit PerftCache(size_t mb_size) : num_entries(mb_size * 1024 * 1024 / sizeof(PerftEntry)) {
+        if (num_entries) {
+            table.reset(new PerftEntry[num_entries]);
+            for (size_t i = 0; i < num_entries; ++i) {
+                table[i].check.store(0, std::memory_order_relaxed);
+                table[i].nodes.store(0, std::memory_order_relaxed);
+            }
+        }
+    }
+
+    bool probe(uint64_t key, int depth, uint64_t& nodes) const {
+        if (!num_entries) return false;
+        uint64_t salted = salt(key, depth);
+        const PerftEntry& e = table[index(salted)];
+        uint64_t n = e.nodes.load(std::memory_order_relaxed);
+        if ((e.check.load(std::memory_order_relaxed) ^ n) != salted) return false;
+        nodes = n;
+        return true;
+    }
+
+    void store(uint64_t key, int depth, uint64_t nodes) {
+        if (!num_entries) return;
+        uint64_t salted = salt(key, depth);
+        PerftEntry& e = table[index(salted)];
+        e.check.store(salted ^ nodes, std::memory_order_relaxed);
+        e.nodes.store(nodes, std::memory_order_relaxed);
+    }
+
+private:
+    std::unique_ptr<PerftEntry[]> table;
+    size_t num_entries;
+
+    // The same position has different counts at different depths
+    static uint64_t salt(uint64_t key, int depth) {
+        return key ^ ((uint64_t)depth * 0x9E3779B97F4A7C15ULL);
+    }
+
+    size_t index(uint64_t salted) const {
+        __extension__ typedef unsigned __int128 uint128;
+        return (size_t)(((uint128)salted * num_entries) >> 64);
+    }
+};
+
+uint64_t perft(int depth, Position& pos) {
+    if (depth == 0) {
+        return 1;
+    }
+
+    Move moves[MAX_MOVES_PER_PLY];
+    int num_moves = 0;
+    generate_legal_moves(pos, moves, num_moves);
+
+    if (depth == 1) {
+        return num_moves;
+    }
+
+    uint64_t nodes = 0;
+    for (int i = 0; i < num_moves; ++i) {
+        pos.make_move(moves[i]);
+        nodes += perft(depth - 1, pos);
+        pos.unmake_move(moves[i]);
+    }
+    return nodes;
+}
+
+uint64_t perft_copy(int depth, const Position& pos) {
+    if (depth == 0) {
+        return 1;
+    }
+
+    Move moves[MAX_MOVES_PER_PLY];
+    int num_moves = 0;
+    generate_legal_moves(pos, moves, num_moves);
+
+    if (depth == 1) {
+        return num_moves;
+    }
+
+    uint64_t nodes = 0;
+    for (int i = 0; i < num_moves; ++i) {
+        Position child = pos;
+        child.make_move(moves[i]);
+        nodes += perft_copy(depth - 1, child);
+    }
+    return nodes;
+}
+
+static uint64_t perft_hashed(int depth, Position& pos, PerftCache& cache) {
+    // Bulk counting already makes depth 1 cheaper than a cache lookup
+    if (depth <= 1) {
+        return perft(depth, pos);
+    }
+
+    uint64_t nodes = 0;
+    if (cache.probe(pos.hash_key, depth, nodes)) {
+        return nodes;
+    }
+
+    Move moves[MAX_MOVES_PER_PLY];
+    int num_moves = 0;
+    generate_legal_moves(pos, moves, num_moves);
+    for (int i = 0; i < num_moves; ++i) {
+        pos.make_move(moves[i]);
+        nodes += perft_hashed(depth - 1, pos, cache);
+        pos.unmake_move(moves[i]);
+    }
+
+    cache.store(pos.hash_key, depth, nodes);
+    return nodes;
+}
+
+uint64_t perft_divide(const Position& pos, int depth, int threads, size_t hash_mb) {
+    auto start_time = std::chrono::steady_clock::now();
+
+    MoveList root_moves;
+    generate_legal_moves(pos, root_moves);
+    std::vector<uint64_t> counts(root_moves.size(), 0);
+
+    if (depth >= 1) {
+        PerftCache cache(hash_mb);
+        std::atomic<size_t> next_move{0};
+
+        // Each worker takes the next unclaimed root move until none are left
+        auto worker = [&]() {
+            StateStack states;
+            Position local = pos;
+            local.set_state_stack(states);
+            size_t i;
+            while ((i = next_move.fetch_add(1)) < root_moves.size()) {
+                local.make_move(root_moves[i]);
+                counts[i] = perft_hashed(depth - 1, local, cache);
+                local.unmake_move(root_moves[i]);
+            }
+        };
+
+        int num_threads = std::max(1, std::min(threads, (int)root_moves.size()));
+        std::vector<std::thread> helpers;
+        for (int t = 1; t < num_threads; ++t) {
+            helpers.emplace_back(worker);
+        }
+        worker();
+        for (auto& t : helpers) {
+            t.join();
+        }
+    }
+
+    uint64_t total = 1;
+    if (depth >= 1) {
+        total = 0;
+        for (size_t i = 0; i < root_moves.size(); ++i) {
+            std::cout << root_moves[i].to_uci_string() << ": " << counts[i] << std::endl;
+            total += counts[i];
+        }
+    }
+
+    auto elapsed_ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start_time).count();
+    std::cout << std::endl;
+    std::cout << "Nodes: " << total << std::endl;
+    std::cout << "Time: " << elapsed_ms << " ms" << std::endl;
+    std::cout << "Nodes/sec: " << (uint64_t)(total * 1000 / (elapsed_ms + 1)) << std::endl;
+    return total;
+}
+
+void perft_compare(const Position& pos, int depth) {
+    auto run = [&](const char* name, auto&& count) {
+        auto start_time = std::chrono::steady_clock::now();
+        uint64_t nodes = count();
+        auto elapsed_ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start_time).count();
+        std::cout << name << ": " << nodes << " nodes, " << elapsed_ms << " ms, "
+                  << (uint64_t)(nodes * 1000 / (elapsed_ms + 1)) << " nps" << std::endl;
+    };
+
+    run("Make/unmake", [&]() {
+        Position local = pos;
+        return perft(depth, local);
+    });
+    run("Copy-make", [&]() { return perft_copy(depth, pos); });
+}
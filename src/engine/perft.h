@@ -0,0 +1,28 @@
+#ifndef PERFT_H
+#define PERFT_H
+
+#include "position.h"
+#include "types.h"
+#include <cstddef>
+#include <cstdint>
+
+// Default size of the perft node-count cache
+const size_t PERFT_HASH_MB = 64;
+
+// Count leaf nodes to `depth`. Moves at the last ply are counted straight
+// from the legal move generator rather than made.
+uint64_t perft(int depth, Position& pos);
+
+// Perft that copies the position for every child instead of unmaking moves
+uint64_t perft_copy(int depth, const Position& pos);
+
+// Time perft() against perft_copy() on the same position and print both
+void perft_compare(const Position& pos, int depth);
+
+// Perft with divide output: prints the node count below every root move,
+// then the total, elapsed time and nodes per second. Root moves are shared
+// out between `threads` workers, and subtree counts are cached in a shared
+// table of `hash_mb` megabytes (0 disables the cache).
+uint64_t perft_divide(const Position& pos, int depth, int threads = 1, size_t hash_mb = PERFT_HASH_MB);
+
+#endif // PERFT_H
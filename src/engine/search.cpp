@@ -1,7 +1,9 @@
 #include "search.h"
 #include "movegen.h"
+#include "movepicker.h"
 #include "evaluate.h"
 #include "tt.h"
+#include "timeman.h"
 #include "move.h"
 #include "nnue.h"
 #include "types.h"
@@ -15,22 +17,32 @@
 #include <chrono>
 #include <vector>
 #include <atomic>
+#include <thread>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <sstream>
+#include <string>
 
 extern Book OPENING_BOOK;
 
 // --- Search Globals ---
 SearchLimits Limits;
-Position RootPosition;
-uint64_t NodeCount;
 std::atomic<bool> StopSearch;
+std::atomic<bool> Pondering;
+
+// Largest piece count probed in the tree, 0 when tablebases are off
+static int TBProbeLimit = 0;
+
+// --- Search Threads ---
+// Threads[0] is the main thread; the rest are Lazy SMP helpers.
+std::vector<std::unique_ptr<SearchThread>> Threads;
 
 // --- Win Probability Calibration ---
 const double WIN_PROB_K = 0.0045;
 const double WIN_PROB_OFFSET = 0.0;
 
-// --- Mate Score ---
-const int MATE_VALUE = 1000000;
-
 // --- Move Ordering Constants ---
 const int TT_HINT = 1000000;
 const int CAP_BASE = 100000;
@@ -42,27 +54,22 @@ const int KILLER1 = 8000;
 const int KILLER2 = 7000;
 const int HISTORY_MAX = 1 << 28;
 
-// --- PV Table ---
-Move PV_TABLE[MAX_PLY + 1][MAX_PLY + 1];
-int PV_LENGTH[MAX_PLY + 1];
-
-// --- Killer Moves ---
-Move KILLER_MOVES[MAX_PLY + 1][2];
-
-// --- History Heuristic ---
-int HISTORY_TABLE[12][64];
-
-// --- Move Lists per Ply ---
-Move CAPTURES[MAX_PLY][128];
-Move QUIETS[MAX_PLY][128];
-int NUM_CAPTURES[MAX_PLY];
-int NUM_QUIETS[MAX_PLY];
-
 // --- Time Management ---
-std::chrono::steady_clock::time_point start_time;
+static int64_t next_info_ms;
+const int64_t INFO_INTERVAL_MS = 1000;
+
+// --- Background Search ---
+static std::thread SearchWorker;
+static std::mutex WorkerMutex;
+static std::condition_variable WorkerCv;
+static bool StopRequested = false;
 
 // --- Monte Carlo Rollout ---
-std::tuple<int, int, int> rollout(Position pos, int max_depth) {
+// The rollout walks away from the searched tree, so the NNUE accumulator is
+// rebuilt for its start position and kept in step with every move; the
+// evaluation cache would otherwise store scores of the wrong position.
+std::tuple<int, int, int> rollout(Position pos, int max_depth, EvalCaches& caches) {
+    NNUE::nnue_evaluator.reset(pos);
     int ply = 0;
     Move moves[256];
     int num_moves = 0;
@@ -81,7 +88,9 @@ std::tuple<int, int, int> rollout(Position pos, int max_depth) {
         for (int i = 0; i < num_moves; ++i) {
             Move m = moves[i];
             if (pos.make_move(m)) {
-                int eval = evaluate(pos);
+                NNUE::nnue_evaluator.update_make(pos, m);
+                int eval = evaluate(pos, caches);
+                NNUE::nnue_evaluator.update_unmake(pos, m);
                 pos.unmake_move(m);
                 evals[i] = eval;
             } else {
@@ -110,10 +119,12 @@ std::tuple<int, int, int> rollout(Position pos, int max_depth) {
                 break;
             }
         }
-        pos.make_move(moves[idx]);
+        if (pos.make_move(moves[idx])) {
+            NNUE::nnue_evaluator.update_make(pos, moves[idx]);
+        }
         ply++;
     }
-    int eval = evaluate(pos);
+    int eval = evaluate(pos, caches);
     if (eval > 0) return {1, 0, 0};
     else if (eval < 0) return {0, 1, 0};
     else return {0, 0, 1};
@@ -165,131 +176,131 @@ double sigmoid_win_prob(int cp_score) {
 }
 
 // --- Time Check ---
-void check_time() {
-    if ((NodeCount & 4095) == 0) {
-        auto current_time = std::chrono::steady_clock::now();
-        auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(current_time - start_time).count();
-        if (elapsed >= Limits.movetime) {
+// Only the main thread watches the clock; helpers just follow StopSearch.
+// It also prints a progress line once a second so long iterations stay visible.
+void check_time(const SearchThread& th) {
+    if (th.id != 0) return;
+    if ((th.nodes.load(std::memory_order_relaxed) & 4095) == 0) {
+        int64_t elapsed = Time.elapsed();
+        if (elapsed >= next_info_ms) {
+            next_info_ms = elapsed + INFO_INTERVAL_MS;
+            uint64_t nodes = total_nodes();
+            std::ostringstream info;
+            info << "info time " << elapsed << " nodes " << nodes << " nps " << (nodes * 1000 / (elapsed + 1));
+            std::cout << info.str() << std::endl;
+        }
+        // While pondering or in infinite mode only `stop` or `ponderhit` ends the search
+        if (Limits.infinite || Pondering) return;
+        if (elapsed >= Time.maximum()) {
             StopSearch = true;
         }
     }
 }
 
 // --- Clear Search Globals ---
-void clear_search_globals() {
-    NodeCount = 0;
-    StopSearch = false;
+void SearchThread::clear() {
+    nodes = 0;
+    completed_depth = 0;
+    best_score = 0;
+    completed_pv_length = 0;
+    root_moves.clear();
+    completed_root_moves.clear();
+    pv_idx = 0;
 
     for (int i = 0; i < MAX_PLY + 1; ++i) {
-        PV_LENGTH[i] = 0;
-        KILLER_MOVES[i][0] = Move(0);
-        KILLER_MOVES[i][1] = Move(0);
+        pv_length[i] = 0;
+        killer_moves[i][0] = Move(0);
+        killer_moves[i][1] = Move(0);
     }
 
     for (int i = 0; i < 12; ++i) {
         for (int j = 0; j < 64; ++j) {
-            HISTORY_TABLE[i][j] = 0;
+            history_table[i][j] = 0;
         }
     }
 }
 
-// --- Policy Score ---
-int policy_score(Move m);
+void clear_search_globals() {
+    for (auto& th : Threads) {
+        th->clear();
+    }
+}
+
+uint64_t total_nodes() {
+    uint64_t nodes = 0;
+    for (const auto& th : Threads) {
+        nodes += th->nodes.load(std::memory_order_relaxed);
+    }
+    return nodes;
+}
+
+// Grow or shrink the thread pool to the requested size
+static void set_thread_count(size_t count) {
+    count = std::max<size_t>(count, 1);
+    while (Threads.size() > count) Threads.pop_back();
+    while (Threads.size() < count) {
+        Threads.push_back(std::make_unique<SearchThread>());
+        Threads.back()->id = (int)Threads.size() - 1;
+    }
+}
 
 // --- Move Scoring ---
-int score_move(Move move, int ply, Move tt_move, const Position& pos) {
+int score_move(const SearchThread& th, Move move, int ply, Move tt_move, const Position& pos) {
     if (move == tt_move) return 1 << 20;
     if (move.is_capture()) {
         int see_score = see(pos, move);
         if (see_score < 0) return 100000 + see_score; // Demote losing captures
         return 100000 + (move.captured_piece() * 10) - move.moving_piece();
     }
-    if (move == KILLER_MOVES[ply][0]) return 8000;
-    if (move == KILLER_MOVES[ply][1]) return 7000;
-    return HISTORY_TABLE[move.moving_piece()][move.to()] + policy_score(move);
-}
-
-// --- Policy Score ---
-int policy_score(Move m) {
-    if (m.is_capture()) return 0;
-    if (m.is_promotion()) return 50;
-    Square to = m.to();
-    int file = get_file(to);
-    int rank = get_rank(to);
-    int center = 4 - std::abs(file - 3) - std::abs(rank - 3);
-    return center;
+    if (move == th.killer_moves[ply][0]) return 8000;
+    if (move == th.killer_moves[ply][1]) return 7000;
+    return th.history_table[move.moving_piece()][move.to()] + policy_score(move);
 }
 
 // --- Move Ordering ---
-void order_moves(MoveList& moves, int ply, Move tt_move, const Position& pos) {
-    for (auto& move : moves) {
-        move.set_ordering_hint(score_move(move, ply, tt_move, pos));
-    }
-    std::sort(moves.begin(), moves.end(), [&](Move a, Move b) {
-        return a.ordering_hint() > b.ordering_hint();
+// Sort on the full scores: the 6-bit ordering hint inside Move is too narrow
+// for them. Search itself uses MovePicker; this is for whole root lists.
+void order_moves(const SearchThread& th, MoveList& moves, int ply, Move tt_move, const Position& pos) {
+    std::vector<std::pair<int, Move>> scored;
+    scored.reserve(moves.size());
+    for (Move move : moves) {
+        scored.push_back({score_move(th, move, ply, tt_move, pos), move});
+    }
+    std::stable_sort(scored.begin(), scored.end(), [](const auto& a, const auto& b) {
+        return a.first > b.first;
     });
-}
-
-void order_moves(Move* captures, int num_captures, Move* quiets, int num_quiets, int ply, Move tt_move, const Position& pos) {
-    // Sort captures
-    for (int i = 0; i < num_captures; ++i) {
-        captures[i].set_ordering_hint(score_move(captures[i], ply, tt_move, pos));
-    }
-    // Simple bubble sort for captures
-    for (int i = 0; i < num_captures - 1; ++i) {
-        for (int j = 0; j < num_captures - i - 1; ++j) {
-            if (captures[j].ordering_hint() < captures[j+1].ordering_hint()) {
-                std::swap(captures[j], captures[j+1]);
-            }
-        }
-    }
-    // Sort quiets
-    for (int i = 0; i < num_quiets; ++i) {
-        quiets[i].set_ordering_hint(score_move(quiets[i], ply, tt_move, pos));
-    }
-    // Simple bubble sort for quiets
-    for (int i = 0; i < num_quiets - 1; ++i) {
-        for (int j = 0; j < num_quiets - i - 1; ++j) {
-            if (quiets[j].ordering_hint() < quiets[j+1].ordering_hint()) {
-                std::swap(quiets[j], quiets[j+1]);
-            }
-        }
+    for (size_t i = 0; i < moves.size(); ++i) {
+        moves[i] = scored[i].second;
     }
 }
 
 // --- Quiescence Search ---
-int quiescence(int alpha, int beta, int ply, Position& pos) {
-    NodeCount++;
+int quiescence(SearchThread& th, int alpha, int beta, int ply, Position& pos) {
+    th.count_node();
     if (StopSearch) return 0;
 
     // Draw detection
     if (is_draw(pos)) return 0;
 
-    if (ply >= MAX_PLY) return evaluate(pos);
+    if (ply >= MAX_PLY) return evaluate(pos, th.eval_caches);
 
     bool in_check = pos.is_check();
-    int stand_pat = evaluate(pos);
+    int stand_pat = evaluate(pos, th.eval_caches);
     if (!in_check && stand_pat >= beta) return beta;
     if (!in_check) alpha = std::max(alpha, stand_pat);
 
-    Move* captures = CAPTURES[ply];
-    int& num_captures = NUM_CAPTURES[ply];
-    Move* quiets = QUIETS[ply];
-    int& num_quiets = NUM_QUIETS[ply];
-    generate_moves(pos, captures, num_captures, quiets, num_quiets, true);
-    Move tt_move = Move(0);
-    order_moves(captures, num_captures, quiets, 0, ply, tt_move, pos); // quiets not used in qsearch
+    MovePicker picker(pos);
+    Move move = picker.next_move();
 
-    if (num_captures == 0) {
+    if (move.value == 0) {
         if (in_check) return -(MATE_VALUE - ply);
         else return stand_pat;
     }
 
-    for (int i = 0; i < num_captures; ++i) {
-        Move move = captures[i];
+    for (; move.value != 0; move = picker.next_move()) {
         if (!pos.make_move(move)) continue;
         NNUE::nnue_evaluator.update_make(pos, move);
-        int score = -quiescence(-beta, -alpha, ply + 1, pos);
+        int score = -quiescence(th, -beta, -alpha, ply + 1, pos);
         NNUE::nnue_evaluator.update_unmake(pos, move);
         pos.unmake_move(move);
 
@@ -301,15 +312,16 @@ int quiescence(int alpha, int beta, int ply, Position& pos) {
 }
 
 // --- Main Search Function ---
-int search(int alpha, int beta, int depth, int ply, Position& pos, bool do_null) {
-    NodeCount++;
-    check_time();
+int search(SearchThread& th, int alpha, int beta, int depth, int ply, Position& pos, bool do_null) {
+    th.count_node();
+    check_time(th);
     if (StopSearch) return 0;
 
     // Draw detection
     if (is_draw(pos)) return 0;
+    if (ply > 0 && pos.is_repetition(ply)) return 0;
 
-    PV_LENGTH[ply] = ply;
+    th.pv_length[ply] = ply;
 
     bool in_check = pos.is_check();
     if (in_check) {
@@ -317,11 +329,11 @@ int search(int alpha, int beta, int depth, int ply, Position& pos, bool do_null)
     }
 
     if (depth <= 0) {
-        return quiescence(alpha, beta, ply, pos);
+        return quiescence(th, alpha, beta, ply, pos);
     }
 
     if (ply >= MAX_PLY) {
-        return evaluate(pos);
+        return evaluate(pos, th.eval_caches);
     }
 
     alpha = std::max(alpha, -(MATE_VALUE - ply));
@@ -331,24 +343,45 @@ int search(int alpha, int beta, int depth, int ply, Position& pos, bool do_null)
     }
 
     Move tt_move = Move(0);
-    TTEntry* tt_entry = TT.probe(pos.hash_key);
-    if (tt_entry) {
-        tt_move = Move(tt_entry->move);
-        if (tt_entry->depth >= depth) {
-            int score = tt_entry->score;
+    TTData tt_entry;
+    if (TT.probe(pos.hash_key, tt_entry)) {
+        tt_move = Move(tt_entry.move);
+        // Never cut at the root: the caller needs a PV, and with shared TT
+        // another thread may already have stored this position deeper
+        if (ply > 0 && tt_entry.depth >= depth) {
+            int score = tt_entry.score;
             if (score > 900000) score -= ply;
             if (score < -900000) score += ply;
 
-            if (tt_entry->flags == TT_EXACT) return score;
-            if (tt_entry->flags == TT_LOWER && score >= beta) return score;
-            if (tt_entry->flags == TT_UPPER && score <= alpha) return score;
+            if (tt_entry.flags == TT_EXACT) return score;
+            if (tt_entry.flags == TT_LOWER && score >= beta) return score;
+            if (tt_entry.flags == TT_UPPER && score <= alpha) return score;
+        }
+    }
+
+    // Tablebase probe. Only right after a capture or pawn move: the WDL
+    // tables know nothing of the moves already played toward the 50-move rule.
+    if (ply > 0 && TBProbeLimit && pos.halfmove_clock == 0 && !pos.castling_rights &&
+        popcnt(pos.occupancy_bitboards[BOTH]) <= TBProbeLimit) {
+        WDLScore wdl;
+        if (probe_wdl(pos, wdl)) {
+            // The result is final; the exact distance to mate is left to the
+            // DTZ probe at the root
+            int score = wdl == WDL_LOSS ? -TB_WIN_SCORE + ply
+                      : wdl == WDL_WIN ? TB_WIN_SCORE - ply
+                      : 2 * wdl; // Draws, with cursed wins just above blessed losses
+            int store_score = score;
+            if (store_score > 900000) store_score += ply;
+            if (store_score < -900000) store_score -= ply;
+            TT.store(pos.hash_key, 0, store_score, std::min(depth + 6, MAX_PLY - 1), TT_EXACT);
+            return score;
         }
     }
 
     int static_eval = -1;
 
     if (depth == 1 && !in_check) {
-        static_eval = evaluate(pos);
+        static_eval = evaluate(pos, th.eval_caches);
         if (static_eval + 300 < alpha) {
             return static_eval;
         }
@@ -358,7 +391,7 @@ int search(int alpha, int beta, int depth, int ply, Position& pos, bool do_null)
         pos.make_null_move();
         NNUE::nnue_evaluator.update_make_null();
         int null_reduction = (depth >= 6) ? 3 : 2;
-        int null_score = -search(-beta, -beta + 1, depth - 1 - null_reduction, ply + 1, pos, false);
+        int null_score = -search(th, -beta, -beta + 1, depth - 1 - null_reduction, ply + 1, pos, false);
         NNUE::nnue_evaluator.update_unmake_null();
         pos.unmake_null_move();
         if (null_score >= beta) {
@@ -366,25 +399,22 @@ int search(int alpha, int beta, int depth, int ply, Position& pos, bool do_null)
         }
     }
 
-    Move* captures = CAPTURES[ply];
-    int& num_captures = NUM_CAPTURES[ply];
-    Move* quiets = QUIETS[ply];
-    int& num_quiets = NUM_QUIETS[ply];
-    generate_moves(pos, captures, num_captures, quiets, num_quiets, false);
-    order_moves(captures, num_captures, quiets, num_quiets, ply, tt_move, pos);
+    MovePicker picker(pos, tt_move, th.killer_moves[ply], th.history_table);
 
     int moves_searched = 0;
+    int moves_pruned = 0;
     int best_score = -MATE_VALUE;
     int second_best = -MATE_VALUE;
     Move best_move = Move(0);
     uint8_t tt_flag = TT_UPPER;
 
-    for (int i = 0; i < num_captures + num_quiets; ++i) {
-        Move move = (i < num_captures) ? captures[i] : quiets[i - num_captures];
+    Move move;
+    while ((move = picker.next_move()).value != 0) {
         if (!in_check && depth <= 2 && !move.is_capture() && !move.is_promotion()) {
-            if (static_eval == -1) static_eval = evaluate(pos);
+            if (static_eval == -1) static_eval = evaluate(pos, th.eval_caches);
             int futility_margin = 100 + 40 * depth;
             if (static_eval + futility_margin <= alpha) {
+                moves_pruned++;
                 continue;
             }
         }
@@ -395,34 +425,31 @@ int search(int alpha, int beta, int depth, int ply, Position& pos, bool do_null)
         int score;
         bool gives_check = pos.is_check();
 
-        int extension = (gives_check ? 1 : 0) + (move.is_promotion() ? 1 : 0);
+        // Checks are extended by the child when it finds itself in check;
+        // extending here as well would grow depth along every checking line
+        int extension = move.is_promotion() ? 1 : 0;
         if (moves_searched == 1) {
-            score = -search(-beta, -alpha, depth - 1 + extension, ply + 1, pos, true);
+            score = -search(th, -beta, -alpha, depth - 1 + extension, ply + 1, pos, true);
         } else {
             int reduction = 0;
             if (depth >= 3 && moves_searched > 3 && !move.is_capture() && !in_check && !gives_check) {
                 reduction = 1 + static_cast<int>(log2(depth) * log2(moves_searched) * 0.66);
             }
 
-            score = -search(-alpha - 1, -alpha, depth - 1 - reduction + extension, ply + 1, pos, true);
+            score = -search(th, -alpha - 1, -alpha, depth - 1 - reduction + extension, ply + 1, pos, true);
             if (score > alpha && score < beta) {
-                score = -search(-beta, -alpha, depth - 1 + extension, ply + 1, pos, true);
+                score = -search(th, -beta, -alpha, depth - 1 + extension, ply + 1, pos, true);
             }
         }
-        if (score > alpha) {
-            alpha = score;
-            PV_TABLE[ply][ply] = move;
-            for (int i = 0; i < PV_LENGTH[ply + 1]; ++i) {
-                PV_TABLE[ply][ply + 1 + i] = PV_TABLE[ply + 1][ply + 1 + i];
-            }
-            PV_LENGTH[ply] = 1 + PV_LENGTH[ply + 1];
-        }
         NNUE::nnue_evaluator.update_unmake(pos, move);
         pos.unmake_move(move);
 
         if (score > best_score) {
+            second_best = best_score;
             best_score = score;
             best_move = move;
+        } else if (score > second_best) {
+            second_best = score;
         }
 
         if (best_score >= beta) {
@@ -431,31 +458,33 @@ int search(int alpha, int beta, int depth, int ply, Position& pos, bool do_null)
             TT.store(pos.hash_key, move.value, store_score, depth, TT_LOWER);
 
             if (!move.is_capture()) {
-                KILLER_MOVES[ply][1] = KILLER_MOVES[ply][0];
-                KILLER_MOVES[ply][0] = move;
-                HISTORY_TABLE[move.moving_piece()][move.to()] = std::min(HISTORY_TABLE[move.moving_piece()][move.to()] + depth * depth * 8, HISTORY_MAX);
+                th.killer_moves[ply][1] = th.killer_moves[ply][0];
+                th.killer_moves[ply][0] = move;
+                th.history_table[move.moving_piece()][move.to()] = std::min(th.history_table[move.moving_piece()][move.to()] + depth * depth * 8, HISTORY_MAX);
             }
             return beta;
         }
 
-        if (best_score > alpha) {
-            alpha = best_score;
+        if (score > alpha) {
+            alpha = score;
             tt_flag = TT_EXACT;
-            PV_TABLE[ply][ply] = move;
-            for (int next_ply = ply + 1; next_ply < PV_LENGTH[ply + 1]; ++next_ply) {
-                PV_TABLE[ply][next_ply] = PV_TABLE[ply + 1][next_ply];
+            th.pv_table[ply][ply] = move;
+            for (int next_ply = ply + 1; next_ply < th.pv_length[ply + 1]; ++next_ply) {
+                th.pv_table[ply][next_ply] = th.pv_table[ply + 1][next_ply];
             }
-            PV_LENGTH[ply] = PV_LENGTH[ply + 1];
+            th.pv_length[ply] = th.pv_length[ply + 1];
         }
     }
 
     if (moves_searched == 0) {
+        // Everything was futility pruned: not a mate or stalemate, just a fail low
+        if (moves_pruned > 0) return alpha;
         return in_check ? -(MATE_VALUE - ply) : 0;
     }
 
-    // Singular extension
-    if (best_score - second_best >= 60 * depth && depth < 60) {
-        int extended_score = search(alpha, beta, depth + 1, ply, pos, do_null);
+    // Singular extension (the re-search passes do_null = false so it cannot extend again)
+    if (do_null && moves_searched > 1 && best_score - second_best >= 60 * depth && depth < 60) {
+        int extended_score = search(th, alpha, beta, depth + 1, ply, pos, false);
         if (abs(extended_score) < MATE_VALUE) {
             best_score = extended_score;
             if (best_score > alpha) alpha = best_score;
@@ -469,44 +498,233 @@ int search(int alpha, int beta, int depth, int ply, Position& pos, bool do_null)
     return alpha;
 }
 
+// --- Root Search ---
+// Walks th.root_moves from pv_idx on in the order left by the previous
+// iteration. Each move's score, PV and node count are recorded here, so no
+// second pass is needed to score the root moves. The root is never pruned,
+// reduced by a null move or singularly extended.
+int search_root(SearchThread& th, int alpha, int beta, int depth, Position& pos) {
+    th.count_node();
+    th.pv_length[0] = 0;
+
+    bool in_check = pos.is_check();
+    if (in_check) {
+        depth++;
+    }
+
+    int moves_searched = 0;
+    int best_score = -MATE_VALUE;
+    Move best_move = Move(0);
+    uint8_t tt_flag = TT_UPPER;
+
+    for (size_t i = th.pv_idx; i < th.root_moves.size(); ++i) {
+        RootMove& rm = th.root_moves[i];
+        Move move = rm.move;
+        uint64_t nodes_before = th.nodes.load(std::memory_order_relaxed);
+
+        pos.make_move(move);
+        NNUE::nnue_evaluator.update_make(pos, move);
+        moves_searched++;
+        int score;
+        bool gives_check = pos.is_check();
+        // Early returns in the child (draws, stop) leave its PV length unset
+        th.pv_length[1] = 1;
+
+        int extension = move.is_promotion() ? 1 : 0;
+        if (moves_searched == 1) {
+            score = -search(th, -beta, -alpha, depth - 1 + extension, 1, pos, true);
+        } else {
+            int reduction = 0;
+            if (depth >= 3 && moves_searched > 3 && !move.is_capture() && !in_check && !gives_check) {
+                reduction = 1 + static_cast<int>(log2(depth) * log2(moves_searched) * 0.66);
+            }
+
+            score = -search(th, -alpha - 1, -alpha, depth - 1 - reduction + extension, 1, pos, true);
+            if (score > alpha && score < beta) {
+                score = -search(th, -beta, -alpha, depth - 1 + extension, 1, pos, true);
+            }
+        }
+        NNUE::nnue_evaluator.update_unmake(pos, move);
+        pos.unmake_move(move);
+
+        rm.nodes += th.nodes.load(std::memory_order_relaxed) - nodes_before;
+        // A partial iteration is thrown away by the caller
+        if (StopSearch) return 0;
+
+        if (score > best_score) {
+            best_score = score;
+            best_move = move;
+        }
+
+        // Anything at or below alpha is only an upper bound
+        if (score <= alpha) {
+            rm.score = -MATE_VALUE;
+            continue;
+        }
+
+        rm.score = score;
+        rm.pv.assign(1, move);
+        for (int next_ply = 1; next_ply < th.pv_length[1]; ++next_ply) {
+            rm.pv.push_back(th.pv_table[1][next_ply]);
+        }
+
+        if (score >= beta) {
+            tt_flag = TT_LOWER;
+            break;
+        }
+
+        alpha = score;
+        tt_flag = TT_EXACT;
+        th.pv_table[0][0] = move;
+        for (int next_ply = 1; next_ply < th.pv_length[1]; ++next_ply) {
+            th.pv_table[0][next_ply] = th.pv_table[1][next_ply];
+        }
+        th.pv_length[0] = th.pv_length[1];
+    }
+
+    // Moves that failed low keep their previous relative order
+    std::stable_sort(th.root_moves.begin() + th.pv_idx, th.root_moves.end());
+
+    if (moves_searched == 0) {
+        return in_check ? -MATE_VALUE : 0;
+    }
 
+    TT.store(pos.hash_key, best_move.value, best_score, depth, tt_flag);
 
+    return tt_flag == TT_LOWER ? beta : alpha;
+}
+
+// --- Aspiration Window Search ---
+// A previous score of -MATE_VALUE means the line has no exact score yet
+int aspiration_search(SearchThread& th, Position& pos, int depth, int prev_score) {
+    bool full_window = depth == 1 || prev_score == -MATE_VALUE;
+    int aspiration = std::max(80, 5 * depth);
+    int alpha = full_window ? -MATE_VALUE : prev_score - aspiration;
+    int beta = full_window ? MATE_VALUE : prev_score + aspiration;
+
+    int score = search_root(th, alpha, beta, depth, pos);
 
+    // If aspiration failed, re-search with wider window
+    if (score <= alpha || score >= beta) {
+        alpha = -MATE_VALUE;
+        beta = MATE_VALUE;
+        score = search_root(th, alpha, beta, depth, pos);
+    }
+    return score;
+}
 
-// --- Get root moves scores ---
-std::vector<std::pair<Move, int>> get_root_moves_scores(Position& pos, int depth) {
+// Fill the root move list with the legal moves, TT move first
+static void init_root_moves(SearchThread& th, const Position& pos) {
     MoveList moves;
-    generate_moves(pos, moves);
-    order_moves(moves, 0, Move(0), pos); // No TT move for simplicity
+    generate_legal_moves(pos, moves);
 
-    std::vector<std::pair<Move, int>> scores;
-    for (const auto& move : moves) {
-        if (pos.make_move(move)) {
-            NNUE::nnue_evaluator.update_make(pos, move);
-            int score = -search(-MATE_VALUE, MATE_VALUE, depth - 1, 1, pos, true);
-            NNUE::nnue_evaluator.update_unmake(pos, move);
-            pos.unmake_move(move);
-            scores.push_back({move, score});
+    Move tt_move = Move(0);
+    TTData tt_entry;
+    if (TT.probe(pos.hash_key, tt_entry)) {
+        tt_move = Move(tt_entry.move);
+    }
+    order_moves(th, moves, 0, tt_move, pos);
+
+    th.root_moves.clear();
+    for (Move move : moves) {
+        th.root_moves.emplace_back(move);
+    }
+}
+
+// One iteration of iterative deepening. Each of the first `multi_pv` lines
+// gets its own aspiration search over the moves not yet settled, so the
+// k-th line is the best move once the first k-1 are excluded.
+int search_iteration(SearchThread& th, Position& pos, int depth, size_t multi_pv) {
+    if (th.root_moves.empty()) {
+        return pos.is_check() ? -MATE_VALUE : 0;
+    }
+
+    for (RootMove& rm : th.root_moves) {
+        rm.previous_score = rm.score;
+    }
+
+    multi_pv = std::min(multi_pv, th.root_moves.size());
+    for (th.pv_idx = 0; th.pv_idx < multi_pv; ++th.pv_idx) {
+        aspiration_search(th, pos, depth, th.root_moves[th.pv_idx].previous_score);
+        if (StopSearch) break;
+        std::stable_sort(th.root_moves.begin(), th.root_moves.begin() + th.pv_idx + 1);
+    }
+    th.pv_idx = 0;
+    return th.root_moves[0].score;
+}
+
+// Remember the result of a fully searched iteration so an aborted one
+// cannot clobber the root PV used for the final answer
+void record_iteration(SearchThread& th, int depth, int score) {
+    th.completed_depth = depth;
+    th.best_score = score;
+    th.completed_root_moves = th.root_moves;
+    th.completed_pv_length = 0;
+    if (!th.root_moves.empty()) {
+        for (Move move : th.root_moves[0].pv) {
+            th.completed_pv[th.completed_pv_length++] = move;
         }
     }
-    return scores;
 }
 
+// --- Helper Thread Search (Lazy SMP) ---
+// Helpers run their own iterative deepening on a private copy of the root and
+// share work only through the TT. Odd helpers start one ply deeper so the
+// threads do not all search the same tree in lockstep. `pos` must already be
+// bound to th.states.
+void helper_search(SearchThread& th, Position pos) {
+    if (NNUE::nnue_available) {
+        NNUE::nnue_evaluator.reset(pos);
+    }
+    init_root_moves(th, pos);
 
+    int score = 0;
+    for (int depth = 1 + (th.id & 1); depth <= Limits.max_depth; ++depth) {
+        score = search_iteration(th, pos, depth, 1);
+        if (StopSearch) break;
+        record_iteration(th, depth, score);
+    }
+}
 
-SearchResult search_position(Position& pos, const SearchLimits& limits, const ChessWizardOptions* opts) {
-    RootPosition = pos;
+// Pick the thread whose result to report: deepest completed iteration wins,
+// ties go to the better score, and the main thread wins remaining ties.
+const SearchThread& best_thread() {
+    const SearchThread* best = Threads[0].get();
+    for (const auto& th : Threads) {
+        if (th->completed_pv_length == 0) continue;
+        if (th->completed_depth > best->completed_depth ||
+            (th->completed_depth == best->completed_depth && th->best_score > best->best_score)) {
+            best = th.get();
+        }
+    }
+    return *best;
+}
+
+// StopSearch is reset by the caller, so a stop request that arrives before a
+// background search gets here is not lost
+static SearchResult run_search(Position& pos, const SearchLimits& limits, const ChessWizardOptions* opts) {
     Limits = limits;
+    Time.init(Limits, pos.side_to_move);
     // Short time mode
-    if (Limits.movetime < 100) {
+    if (!Limits.infinite && Time.maximum() < 100) {
         Limits.max_depth = std::min(Limits.max_depth, 6);
     }
+    // C API callers may leave the field unset, so bound it like the UCI option
+    set_thread_count(opts ? std::clamp<uint32_t>(opts->threads, 1, (uint32_t)MAX_THREADS) : 1);
     clear_search_globals();
-    start_time = std::chrono::steady_clock::now();
-
-    if (opts && opts->use_nnue) {
+    SearchThread& main_thread = *Threads[0];
+    next_info_ms = INFO_INTERVAL_MS;
+
+    // The net is read again only when its path changes or the last load
+    // failed, so cached network scores carry over from move to move
+    static std::string loaded_nnue_path;
+    if (opts && opts->use_nnue && opts->nnue_path
+        && (!NNUE::nnue_available || loaded_nnue_path != opts->nnue_path)) {
         if (NNUE::nnue_evaluator.init(opts->nnue_path)) {
+            loaded_nnue_path = opts->nnue_path;
             set_use_nnue(true);
+        } else {
+            set_use_nnue(false);
         }
     }
 
@@ -514,8 +732,24 @@ SearchResult search_position(Position& pos, const SearchLimits& limits, const Ch
         NNUE::nnue_evaluator.reset(pos);
     }
 
-    // Syzygy tablebase
+    // Syzygy tablebase: tables given through the options are loaded on first
+    // use, and the root is answered from DTZ when it is covered
+    TBProbeLimit = 0;
     if (opts && opts->use_syzygy) {
+        if (opts->tb_paths) {
+            std::string paths;
+            for (const char** p = opts->tb_paths; *p; ++p) {
+                if (!paths.empty()) paths += ':';
+                paths += *p;
+            }
+            static std::string loaded_paths;
+            if (paths != loaded_paths) {
+                syzygy_init(paths);
+                loaded_paths = paths;
+            }
+        }
+        TBProbeLimit = TB_LARGEST;
+
         TBResult tb_result;
         if (probe_syzygy(pos, tb_result)) {
             SearchResult result = {};
@@ -539,7 +773,7 @@ SearchResult search_position(Position& pos, const SearchLimits& limits, const Ch
         if (!OPENING_BOOK.is_loaded()) {
             OPENING_BOOK.load(opts->book_path);
         }
-        Move book_move = OPENING_BOOK.get_move(pos.hash_key);
+        Move book_move = OPENING_BOOK.get_move(pos, opts->seed);
         if (book_move.value != 0) {
             SearchResult result = {};
             std::string uci = book_move.to_uci_string();
@@ -562,27 +796,24 @@ SearchResult search_position(Position& pos, const SearchLimits& limits, const Ch
     int last_completed_depth = 0;
     std::vector<int> depth_scores;
     std::vector<double> win_probs;
-    std::vector<std::pair<Move, int>> last_moves_scores;
+    size_t multi_pv = opts && opts->multi_pv > 1 ? opts->multi_pv : 1;
 
-    for (int current_depth = 1; current_depth <= Limits.max_depth; ++current_depth) {
-        int aspiration = std::max(80, 5 * current_depth);
-        int alpha = (current_depth == 1) ? -MATE_VALUE : score - aspiration;
-        int beta = (current_depth == 1) ? MATE_VALUE : score + aspiration;
+    // New search generation: older TT entries become preferred victims
+    TT.increment_age();
 
-        score = search(alpha, beta, current_depth, 0, pos, true);
-
-        // If aspiration failed, re-search with wider window
-        if (score <= alpha || score >= beta) {
-            alpha = -MATE_VALUE;
-            beta = MATE_VALUE;
-            score = search(alpha, beta, current_depth, 0, pos, true);
-        }
+    init_root_moves(main_thread, pos);
 
-        if (StopSearch && current_depth > 1) {
-            break;
-        }
+    // The game history is copied to each helper's stack here, before the
+    // main thread starts pushing moves onto (and possibly growing) its own
+    std::vector<std::thread> helpers;
+    for (size_t i = 1; i < Threads.size(); ++i) {
+        Position helper_pos = pos;
+        helper_pos.set_state_stack(Threads[i]->states);
+        helpers.emplace_back(helper_search, std::ref(*Threads[i]), helper_pos);
+    }
 
-        last_moves_scores = get_root_moves_scores(pos, current_depth);
+    for (int current_depth = 1; current_depth <= Limits.max_depth; ++current_depth) {
+        score = search_iteration(main_thread, pos, current_depth, multi_pv);
 
         if (StopSearch && current_depth > 1) {
             break;
@@ -590,45 +821,83 @@ SearchResult search_position(Position& pos, const SearchLimits& limits, const Ch
 
         last_score = score;
         last_completed_depth = current_depth;
+        record_iteration(main_thread, current_depth, score);
         depth_scores.push_back(score);
         win_probs.push_back(sigmoid_win_prob(score));
 
-        auto end_time = std::chrono::steady_clock::now();
-        auto elapsed_ms = std::chrono::duration_cast<std::chrono::milliseconds>(end_time - start_time).count();
-        std::cout << "info depth " << current_depth << " score cp " << score
-                  << " nodes " << NodeCount << " nps " << (NodeCount * 1000 / (elapsed_ms + 1))
-                  << " time " << elapsed_ms << " pv ";
-        for (int i = 0; i < PV_LENGTH[0]; ++i) {
-            std::cout << PV_TABLE[0][i].to_uci_string() << " ";
+        uint64_t nodes = total_nodes();
+        int64_t elapsed_ms = Time.elapsed();
+        size_t lines = std::min(multi_pv, main_thread.root_moves.size());
+        for (size_t k = 0; k < std::max<size_t>(lines, 1); ++k) {
+            int line_score = lines > 0 ? main_thread.root_moves[k].score : score;
+            std::cout << "info depth " << current_depth;
+            if (multi_pv > 1) std::cout << " multipv " << k + 1;
+            std::cout << " score cp " << line_score
+                      << " nodes " << nodes << " nps " << (nodes * 1000 / (elapsed_ms + 1))
+                      << " time " << elapsed_ms << " pv ";
+            if (lines > 0) {
+                for (Move move : main_thread.root_moves[k].pv) {
+                    std::cout << move.to_uci_string() << " ";
+                }
+            }
+            std::cout << std::endl;
         }
-        std::cout << std::endl;
+
+        // Soft stop: the clock budget is checked only between iterations
+        Move best_move = lines > 0 ? main_thread.root_moves[0].move : Move(0);
+        uint64_t main_nodes = main_thread.nodes.load(std::memory_order_relaxed);
+        double best_move_effort = lines > 0 && main_nodes > 0
+            ? (double)main_thread.root_moves[0].nodes / main_nodes : 0.0;
+        bool out_of_time = Time.stop_after_iteration(best_move, score, best_move_effort);
+        if (out_of_time && !Limits.infinite && !Pondering) {
+            break;
+        }
+    }
+
+    // Stop and collect the helpers
+    StopSearch = true;
+    for (auto& t : helpers) {
+        t.join();
     }
 
     SearchResult result = {};
 
-    // Monte Carlo tie-break disabled for now
-    if (PV_LENGTH[0] > 0) {
-        strncpy(result.best_move_uci, PV_TABLE[0][0].to_uci_string().c_str(), 7);
+    const SearchThread& best = best_thread();
+    if (best.completed_pv_length > 0) {
+        score = best.best_score;
+        last_completed_depth = best.completed_depth;
+    }
+
+    if (best.completed_pv_length > 0) {
+        strncpy(result.best_move_uci, best.completed_pv[0].to_uci_string().c_str(), 7);
         result.best_move_uci[7] = '\0';
 
         std::string json = "[";
-        for (int i = 0; i < PV_LENGTH[0]; ++i) {
-            json += "\"" + PV_TABLE[0][i].to_uci_string() + "\"";
-            if (i < PV_LENGTH[0] - 1) json += ",";
+        for (int i = 0; i < best.completed_pv_length; ++i) {
+            json += "\"" + best.completed_pv[i].to_uci_string() + "\"";
+            if (i < best.completed_pv_length - 1) json += ",";
         }
         json += "]";
         result.pv_json = (char*)malloc(json.size() + 1);
         strcpy(result.pv_json, json.c_str());
     } else {
-        result.pv_json = (char*)malloc(3);
-        strcpy(result.pv_json, "[]");
+        // Stopped before depth 1 finished: still answer with a legal move
+        MoveList legal_moves;
+        generate_legal_moves(pos, legal_moves);
+        std::string json = "[]";
+        if (!legal_moves.empty()) {
+            std::string uci = legal_moves[0].to_uci_string();
+            strncpy(result.best_move_uci, uci.c_str(), 7);
+            json = "[\"" + uci + "\"]";
+        }
+        result.pv_json = (char*)malloc(json.size() + 1);
+        strcpy(result.pv_json, json.c_str());
     }
 
     result.score_cp = score;
     result.depth = last_completed_depth;
-    result.nodes = NodeCount;
-    auto final_time = std::chrono::steady_clock::now();
-    result.time_ms = std::chrono::duration_cast<std::chrono::milliseconds>(final_time - start_time).count();
+    result.nodes = total_nodes();
+    result.time_ms = Time.elapsed();
 
     result.win_prob = sigmoid_win_prob(score);
 
@@ -643,32 +912,37 @@ SearchResult search_position(Position& pos, const SearchLimits& limits, const Ch
         result.win_prob_stddev = sigmoid_win_prob(score + stddev_cp) - sigmoid_win_prob(score - stddev_cp);
     }
 
-    // Monte Carlo tie-break
-    std::sort(last_moves_scores.begin(), last_moves_scores.end(), [](const auto& a, const auto& b) {
-        return a.second > b.second;
-    });
-    if (last_moves_scores.size() >= 2 && abs(last_moves_scores[0].second - last_moves_scores[1].second) <= 20) {
+    // Monte Carlo tie-break between the two best root moves. Without MultiPV
+    // the runner-up only has an exact score if it led at some point during
+    // the iteration; a bound is not close enough to call it a tie.
+    const std::vector<RootMove>& root_moves = best.completed_root_moves;
+    if (root_moves.size() >= 2 && root_moves[1].score != -MATE_VALUE &&
+        abs(root_moves[0].score - root_moves[1].score) <= 20) {
         // Run rollouts for top 2 moves
         Position temp_pos = pos;
-        temp_pos.make_move(last_moves_scores[0].first);
-        auto [w1, l1, d1] = rollout(temp_pos, 40);
+        temp_pos.make_move(root_moves[0].move);
+        auto [w1, l1, d1] = rollout(temp_pos, 40, main_thread.eval_caches);
         double wr1 = (w1 + 0.5 * d1) / (w1 + l1 + d1 + 1e-9); // avoid div0
 
         temp_pos = pos;
-        temp_pos.make_move(last_moves_scores[1].first);
-        auto [w2, l2, d2] = rollout(temp_pos, 40);
+        temp_pos.make_move(root_moves[1].move);
+        auto [w2, l2, d2] = rollout(temp_pos, 40, main_thread.eval_caches);
         double wr2 = (w2 + 0.5 * d2) / (w2 + l2 + d2 + 1e-9);
 
         if (wr2 > wr1) {
             // Choose the second move
-            std::swap(last_moves_scores[0], last_moves_scores[1]);
-            std::string uci = last_moves_scores[0].first.to_uci_string();
-            strncpy(result.best_move_uci, uci.c_str(), 7);
-            std::string json = "[\"" + uci + "\"]";
+            const RootMove& second = root_moves[1];
+            strncpy(result.best_move_uci, second.move.to_uci_string().c_str(), 7);
+            std::string json = "[";
+            for (size_t i = 0; i < second.pv.size(); ++i) {
+                json += "\"" + second.pv[i].to_uci_string() + "\"";
+                if (i + 1 < second.pv.size()) json += ",";
+            }
+            json += "]";
             free(result.pv_json); // free previous
             result.pv_json = (char*)malloc(json.size() + 1);
             strcpy(result.pv_json, json.c_str());
-            result.score_cp = last_moves_scores[0].second;
+            result.score_cp = second.score;
             result.win_prob = sigmoid_win_prob(result.score_cp);
         }
         result.info_flags |= MC_TIEBREAK;
@@ -677,54 +951,58 @@ SearchResult search_position(Position& pos, const SearchLimits& limits, const Ch
     return result;
 }
 
-// --- Perft ---
-uint64_t perft(int depth, Position& pos) {
-    if (depth == 0) {
-        return 1;
-    }
+SearchResult search_position(Position& pos, const SearchLimits& limits, const ChessWizardOptions* opts) {
+    StopSearch = false;
+    Pondering = false;
+    return run_search(pos, limits, opts);
+}
 
-    MoveList moves;
-    generate_legal_moves(pos, moves);
-    uint64_t nodes = 0;
+void start_search(const Position& pos, const SearchLimits& limits, const ChessWizardOptions* opts, bool ponder,
+                  std::function<void(const SearchResult&)> on_done) {
+    wait_for_search();
+    StopSearch = false;
+    Pondering = ponder;
+    StopRequested = false;
 
-    if (depth == 1) {
-        return moves.size();
-    }
+    SearchWorker = std::thread([root = pos, limits, opts, on_done]() mutable {
+        StateStack states;
+        root.set_state_stack(states);
+        SearchResult result = run_search(root, limits, opts);
 
-    for (const auto& move : moves) {
-        if (pos.make_move(move)) {
-            nodes += perft(depth - 1, pos);
-            pos.unmake_move(move);
+        // UCI forbids a bestmove before `stop` or `ponderhit` in these modes,
+        // even if the search reached its depth limit first
+        {
+            std::unique_lock<std::mutex> lock(WorkerMutex);
+            WorkerCv.wait(lock, [&]() { return StopRequested || (!limits.infinite && !Pondering); });
         }
-    }
 
-    return nodes;
+        on_done(result);
+        free(result.pv_json);
+        free(result.error_message);
+    });
 }
 
-// Debug perft to print moves at depth 1
-uint64_t perft_debug(int depth, Position& pos, int original_depth) {
-    if (depth == 0) {
-        return 1;
+void stop_search() {
+    StopSearch = true;
+    {
+        std::lock_guard<std::mutex> lock(WorkerMutex);
+        StopRequested = true;
     }
+    WorkerCv.notify_all();
+}
 
-    MoveList moves;
-    generate_legal_moves(pos, moves);
-    uint64_t nodes = 0;
-
-    if (depth == 1) {
-        std::cerr << "Moves at depth 1: " << moves.size() << std::endl;
-        return moves.size();
+// The clock keeps running from `go`, so time spent pondering on the
+// expected move counts towards the move's budget
+void ponderhit() {
+    {
+        std::lock_guard<std::mutex> lock(WorkerMutex);
+        Pondering = false;
     }
+    WorkerCv.notify_all();
+}
 
-    for (const auto& move : moves) {
-        pos.make_move(move);
-        uint64_t sub_nodes = perft_debug(depth - 1, pos, original_depth);
-        if (depth == 3) {
-            std::cout << move.to_uci_string() << ": " << sub_nodes << std::endl;
-        }
-        nodes += sub_nodes;
-        pos.unmake_move(move);
+void wait_for_search() {
+    if (SearchWorker.joinable()) {
+        SearchWorker.join();
     }
-
-    return nodes;
 }
\ No newline at end of file
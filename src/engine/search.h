@@ -3,46 +3,113 @@
 
 #include "position.h"
 #include "types.h"
+#include "evaluate.h"
 #include <vector>
 #include <tuple>
+#include <atomic>
+#include <functional>
+
+// Mate score; mate in n plies scores MATE_VALUE - n
+const int MATE_VALUE = 1000000;
+
+// Tablebase wins score below any mate the search can find
+const int TB_WIN_SCORE = MATE_VALUE - 2 * MAX_PLY;
+
+// Upper bound on search threads, however they are requested
+const int MAX_THREADS = 256;
+
+// A legal move at the root with what the search has learned about it. Only
+// moves that ended inside the window get an exact score; the others keep
+// -MATE_VALUE. Sorting puts the best moves first, falling back to the
+// previous iteration's order for moves without a score.
+struct RootMove {
+    Move move;
+    int score = -MATE_VALUE;
+    int previous_score = -MATE_VALUE;
+    uint64_t nodes = 0; // Nodes spent below this move during the whole search
+    std::vector<Move> pv;
+
+    explicit RootMove(Move m) : move(m) {}
+    bool operator<(const RootMove& other) const {
+        return score != other.score ? score > other.score : previous_score > other.previous_score;
+    }
+};
+
+// Per-thread search state (Lazy SMP). Every search thread owns one of these;
+// the transposition table is the only structure shared between threads.
+struct SearchThread {
+    int id = 0;
+    std::atomic<uint64_t> nodes{0};
+    int completed_depth = 0;
+    int best_score = 0;
+
+    // PV table
+    Move pv_table[MAX_PLY + 1][MAX_PLY + 1];
+    int pv_length[MAX_PLY + 1];
+
+    // Killer moves and history heuristic
+    Move killer_moves[MAX_PLY + 1][2];
+    int history_table[12][64];
+
+    // Root PV of the last fully completed iteration
+    Move completed_pv[MAX_PLY + 1];
+    int completed_pv_length = 0;
+
+    // Root moves, best first, and their state after the last completed
+    // iteration. pv_idx is the MultiPV line being searched: moves before it
+    // are already settled for this iteration.
+    std::vector<RootMove> root_moves;
+    std::vector<RootMove> completed_root_moves;
+    size_t pv_idx = 0;
+
+    // Undo stack for the helper's copy of the root position
+    StateStack states;
+
+    // Pawn and network score caches; kept when the thread's state is cleared
+    // for a new search
+    EvalCaches eval_caches;
+
+    void clear();
+
+    // Only the owning thread writes its counter, so a relaxed load/store pair
+    // is enough and avoids a locked add on every node.
+    void count_node() { nodes.store(nodes.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed); }
+};
 
 // Main search function
 SearchResult search_position(Position& pos, const SearchLimits& limits, const ChessWizardOptions* opts);
 
-// Perft test function
-uint64_t perft(int depth, Position& pos);
-uint64_t perft_debug(int depth, Position& pos, int original_depth);
+// Background search for UCI: runs search_position on a worker thread and
+// hands the result to `on_done` from that thread. In infinite or ponder mode
+// the result is held back until stop_search() or ponderhit().
+void start_search(const Position& pos, const SearchLimits& limits, const ChessWizardOptions* opts, bool ponder,
+                  std::function<void(const SearchResult&)> on_done);
+void stop_search();
+void ponderhit();
+void wait_for_search();
 
 // Helper functions
 bool is_draw(const Position& pos);
 double sigmoid_win_prob(int cp_score);
-void check_time();
+void check_time(const SearchThread& th);
 void clear_search_globals();
+uint64_t total_nodes();
 
 // Search functions
-int search(int alpha, int beta, int depth, int ply, Position& pos, bool do_null = true);
-int quiescence(int alpha, int beta, int ply, Position& pos);
+int search_root(SearchThread& th, int alpha, int beta, int depth, Position& pos);
+int search(SearchThread& th, int alpha, int beta, int depth, int ply, Position& pos, bool do_null = true);
+int quiescence(SearchThread& th, int alpha, int beta, int ply, Position& pos);
 
 // Monte Carlo rollout
-std::tuple<int, int, int> rollout(Position pos, int max_depth);
+std::tuple<int, int, int> rollout(Position pos, int max_depth, EvalCaches& caches);
 
 // Move ordering
-int score_move(Move move, int ply, Move tt_move, const Position& pos);
-void order_moves(MoveList& moves, int ply, Move tt_move, const Position& pos);
-void order_moves(Move* captures, int num_captures, Move* quiets, int num_quiets, int ply, Move tt_move, const Position& pos);
+int score_move(const SearchThread& th, Move move, int ply, Move tt_move, const Position& pos);
+void order_moves(const SearchThread& th, MoveList& moves, int ply, Move tt_move, const Position& pos);
 
 // Search globals (to be initialized per search)
 extern SearchLimits Limits;
-extern Position RootPosition;
-extern uint64_t NodeCount;
 extern std::atomic<bool> StopSearch;
+extern std::atomic<bool> Pondering;
 
-// PV table
-extern Move PV_TABLE[MAX_PLY + 1][MAX_PLY + 1];
-extern int PV_LENGTH[MAX_PLY + 1];
-extern Move KILLER_MOVES[MAX_PLY + 1][2];
-
-// History heuristic
-extern int HISTORY_TABLE[12][64];
-
-#endif // SEARCH_H
\ No newline at end of file
+#endif // SEARCH_H
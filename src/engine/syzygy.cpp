@@ -1,82 +1,1104 @@
 #include "syzygy.h"
+#include "search.h"
 #include "attack.h"
 #include "movegen.h"
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <climits>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <unordered_map>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
-int get_material(const Position& pos, Color c) {
-    int mat = 0;
-    for (int p = WP; p <= BK; ++p) {
-        if (get_piece_color((PieceType)p) == c) {
-            mat += __builtin_popcountll(pos.piece_bitboards[p]) * SEE_VALUES[p];
+// Syzygy tablebase probing. Each material signature like KRPvKR has a WDL
+// file (.rtbw) and a DTZ file (.rtbz). A position is turned into an index by
+// placing its pieces in a canonical order and orientation, and the value at
+// that index is decoded from blocks compressed with canonical Huffman codes
+// over a recursive-pairing grammar.
+//
+// A full set is far larger than the address space we want to commit, so a
+// file is mapped only when its material is first probed, and once the mapped
+// bytes pass the configured limit the least recently probed files are
+// unmapped again.
+
+int TB_LARGEST = 0;
+
+// --- Table Layout Constants ---
+const int TB_PIECES = 7; // Largest tables in existence
+
+enum TableType { WDL_TABLE, DTZ_TABLE };
+
+// Per-table flags stored in the file
+enum TBFlag : uint8_t {
+    TB_STM = 1,
+    TB_MAPPED = 2,
+    TB_WIN_PLIES = 4,
+    TB_LOSS_PLIES = 8,
+    TB_WIDE = 16,
+    TB_SINGLE_VALUE = 128
+};
+
+// How a probe ended. CHANGE_STM means a DTZ table holds only the other side
+// to move; ZEROING_BEST_MOVE means the best move is a capture or pawn move,
+// for which DTZ stores no useful value.
+enum ProbeState { PROBE_FAIL = 0, PROBE_OK = 1, PROBE_CHANGE_STM = -1, PROBE_ZEROING_BEST_MOVE = 2 };
+
+const uint8_t WDL_MAGIC[4] = {0x71, 0xE8, 0x23, 0x5D};
+const uint8_t DTZ_MAGIC[4] = {0xD7, 0x66, 0x0C, 0xA5};
+
+// Piece letters in the file names, indexed by GenericPieceType
+const char TB_PIECE_CHARS[] = "PNBRQK";
+
+// --- Encoding Tables ---
+static int MapPawns[64];
+static int MapB1H1H7[64];
+static int MapA1D1D4[64];
+static int MapKK[10][64];
+static uint64_t Binomial[6][64];    // [k][n]: ways to choose k of n squares
+static uint64_t LeadPawnIdx[6][64]; // [lead pawn count][square]
+static uint64_t LeadPawnsSize[6][4]; // [lead pawn count][FILE_A..FILE_D]
+
+// Files are little-endian except the Huffman bit stream, which is read as
+// big-endian words. Reads go through bytes so alignment never matters.
+template<typename T>
+static T read_le(const uint8_t* p) {
+    T v;
+    std::memcpy(&v, p, sizeof(T));
+    if constexpr (std::endian::native == std::endian::big) {
+        T r = 0;
+        for (size_t i = 0; i < sizeof(T); ++i) r = (T)((r << 8) | p[sizeof(T) - 1 - i]);
+        return r;
+    }
+    return v;
+}
+
+template<typename T>
+static T read_be(const uint8_t* p) {
+    T r = 0;
+    for (size_t i = 0; i < sizeof(T); ++i) r = (T)((uint64_t)r << 8 | p[i]);
+    return r;
+}
+
+static int off_a1h8(int sq) { return rank_of((Square)sq) - file_of((Square)sq); }
+static int flip_file(int sq) { return sq ^ 7; }
+static int flip_rank(int sq) { return sq ^ 56; }
+static int edge_distance(int file) { return std::min(file, 7 - file); }
+
+// Piece codes used inside the files: 1..6 for white pawn..king, 9..14 for black
+static int tb_piece(int pt) { return pt < BP ? pt + 1 : pt + 3; }
+
+static bool pawns_comp(int a, int b) { return MapPawns[a] < MapPawns[b]; }
+
+// Material signature: four bits per piece count for pawns to queens, White
+// in the low twenty bits and Black above
+static uint64_t material_key(const int counts[2][5]) {
+    uint64_t key = 0;
+    for (int c = 0; c < 2; ++c) {
+        for (int pt = 0; pt < 5; ++pt) {
+            key |= (uint64_t)counts[c][pt] << (20 * c + 4 * pt);
         }
     }
-    return mat;
+    return key;
 }
 
-bool probe_syzygy(Position& pos, TBResult& result) {
-    int white_mat = get_material(pos, WHITE);
-    int black_mat = get_material(pos, BLACK);
-
-    // K vs K
-    if (white_mat == 0 && black_mat == 0) {
-        result.score = 0;
-        result.dtz = 0;
-        MoveList moves;
-        generate_moves(pos, moves);
-        if (!moves.empty()) result.best_move = moves[0];
-        return true;
-    }
-
-    // KQ vs K
-    if (white_mat == SEE_VALUES[WQ] && black_mat == 0) {
-        result.score = 1000000;
-        result.dtz = 1;
-        MoveList moves;
-        generate_moves(pos, moves);
-        for (auto m : moves) {
-            if (m.captured_piece() == BK) {
-                result.best_move = m;
-                return true;
+static uint64_t material_key(const Position& pos) {
+    int counts[2][5];
+    for (int pt = 0; pt < 5; ++pt) {
+        counts[WHITE][pt] = popcnt(pos.piece_bitboards[pt]);
+        counts[BLACK][pt] = popcnt(pos.piece_bitboards[pt + 6]);
+    }
+    return material_key(counts);
+}
+
+// --- Compressed Data ---
+// Decoding state for one sub-table: a side to move and, in pawn tables, a
+// file of the leading pawn. The pointers point into the mapped file.
+struct PairsData {
+    uint8_t flags = 0;
+    uint8_t max_sym_len = 0;
+    uint8_t min_sym_len = 0; // The stored value itself for TB_SINGLE_VALUE tables
+    uint32_t num_blocks = 0;
+    size_t block_size = 0;
+    size_t span = 0;
+    const uint8_t* lowest_sym = nullptr;   // uint16 per code length
+    const uint8_t* btree = nullptr;        // 3 bytes per symbol: two 12-bit children
+    const uint8_t* block_length = nullptr; // uint16 per block: values in the block - 1
+    uint32_t block_length_size = 0;
+    const uint8_t* sparse_index = nullptr; // 6 bytes per entry: uint32 block, uint16 offset
+    size_t sparse_index_size = 0;
+    const uint8_t* data = nullptr;
+    std::vector<uint64_t> base64; // Lowest code of each length, left-aligned
+    std::vector<uint8_t> symlen;  // Values a symbol expands to, minus one
+    uint8_t pieces[TB_PIECES] = {};
+    uint64_t group_idx[TB_PIECES + 1] = {};
+    int group_len[TB_PIECES + 1] = {};
+    uint16_t map_idx[4] = {}; // DTZ: start of the value map for each WDL outcome
+};
+
+static int btree_left(const PairsData* d, int sym) {
+    const uint8_t* lr = d->btree + 3 * sym;
+    return ((lr[1] & 0xF) << 8) | lr[0];
+}
+
+static int btree_right(const PairsData* d, int sym) {
+    const uint8_t* lr = d->btree + 3 * sym;
+    return (lr[2] << 4) | (lr[1] >> 4);
+}
+
+// Mapping state of a table file
+enum FileState { FILE_UNMAPPED, FILE_MAPPED, FILE_MISSING, FILE_EVICTING };
+
+// One WDL or DTZ file. The fields describing the material are filled at
+// init; the file is mapped and the PairsData parsed on first probe.
+struct TBTable {
+    TableType type;
+    std::string name; // Like "KRPvKR", White as the first side
+    uint64_t key;     // Material key with the first side as White
+    uint64_t key2;    // ...and as Black
+    int piece_count;
+    bool has_pawns;
+    bool has_unique_pieces;
+    uint8_t pawn_count[2]; // [leading color, other color]
+
+    // A probe pins the table in `users` before reading `state`, and eviction
+    // marks the table before reading `users`, so a mapping is never removed
+    // under a probe. Both sides use sequentially consistent accesses.
+    std::atomic<int> state{FILE_UNMAPPED};
+    std::atomic<int> users{0};
+    std::atomic<uint64_t> last_used{0};
+    void* base = nullptr;
+    size_t mapping = 0;
+    const uint8_t* map = nullptr; // DTZ value maps
+    PairsData items[2][4]; // [side to move][leading pawn file, or 0]
+
+    int sides() const { return type == WDL_TABLE ? 2 : 1; }
+    PairsData* get(int stm, int file) { return &items[stm % sides()][has_pawns ? file : 0]; }
+};
+
+struct TBEntry {
+    TBTable* wdl;
+    TBTable* dtz;
+};
+
+static std::string TBPaths;
+static std::vector<std::unique_ptr<TBTable>> TBTables;
+static std::unordered_map<uint64_t, TBEntry> TBIndex;
+
+// Mapped bytes and their limit (0 for none), both guarded by TBMapMutex
+static std::mutex TBMapMutex;
+static size_t TBMappedBytes = 0;
+static size_t TBMapLimit = 0;
+
+// Ticks on every probe, for least-recently-used eviction
+static std::atomic<uint64_t> TBClock{0};
+
+// --- File Access ---
+static bool find_file(const std::string& fname, std::string& path) {
+    std::stringstream ss(TBPaths);
+    std::string dir;
+    while (std::getline(ss, dir, ':')) {
+        if (dir.empty()) continue;
+        std::string candidate = dir + "/" + fname;
+        if (access(candidate.c_str(), R_OK) == 0) {
+            path = candidate;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Unmap least recently used tables until `incoming` more bytes fit under the
+// limit. Pinned tables are skipped, so the limit may be exceeded while every
+// mapped table is in use. Called with TBMapMutex held.
+static void evict_for(size_t incoming) {
+    if (!TBMapLimit || TBMappedBytes + incoming <= TBMapLimit) return;
+
+    std::vector<TBTable*> mapped;
+    for (auto& t : TBTables) {
+        if (t->state.load() == FILE_MAPPED) mapped.push_back(t.get());
+    }
+    std::sort(mapped.begin(), mapped.end(), [](const TBTable* a, const TBTable* b) {
+        return a->last_used.load(std::memory_order_relaxed) < b->last_used.load(std::memory_order_relaxed);
+    });
+
+    for (TBTable* t : mapped) {
+        if (TBMappedBytes + incoming <= TBMapLimit) break;
+        t->state.store(FILE_EVICTING);
+        if (t->users.load() != 0) {
+            t->state.store(FILE_MAPPED);
+            continue;
+        }
+        munmap(t->base, t->mapping);
+        TBMappedBytes -= t->mapping;
+        t->base = nullptr;
+        t->mapping = 0;
+        t->state.store(FILE_UNMAPPED);
+    }
+}
+
+// Map the file read-only and check its magic. Returns a pointer just past
+// the magic, or nullptr if the file is missing or corrupt.
+static const uint8_t* map_file(TBTable& e) {
+    std::string path;
+    std::string fname = e.name + (e.type == WDL_TABLE ? ".rtbw" : ".rtbz");
+    if (!find_file(fname, path)) return nullptr;
+
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd == -1) return nullptr;
+
+    struct stat st;
+    if (fstat(fd, &st) == -1 || st.st_size % 64 != 16) {
+        std::cout << "info string Syzygy: corrupt tablebase file " << path << std::endl;
+        close(fd);
+        return nullptr;
+    }
+
+    evict_for(st.st_size);
+    void* base = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        std::cout << "info string Syzygy: could not map " << path << std::endl;
+        return nullptr;
+    }
+    madvise(base, st.st_size, MADV_RANDOM);
+
+    const uint8_t* magic = e.type == WDL_TABLE ? WDL_MAGIC : DTZ_MAGIC;
+    if (std::memcmp(base, magic, 4) != 0) {
+        std::cout << "info string Syzygy: corrupt tablebase file " << path << std::endl;
+        munmap(base, st.st_size);
+        return nullptr;
+    }
+
+    e.base = base;
+    e.mapping = st.st_size;
+    TBMappedBytes += e.mapping;
+    return (const uint8_t*)base + 4;
+}
+
+// --- Table Parsing ---
+static uint8_t set_symlen(PairsData* d, int s, std::vector<bool>& visited) {
+    visited[s] = true; // The grammar is acyclic
+    int sr = btree_right(d, s);
+    if (sr == 0xFFF) return 0; // Leaf
+
+    int sl = btree_left(d, s);
+    if (!visited[sl]) d->symlen[sl] = set_symlen(d, sl, visited);
+    if (!visited[sr]) d->symlen[sr] = set_symlen(d, sr, visited);
+    return d->symlen[sl] + d->symlen[sr] + 1;
+}
+
+static const uint8_t* set_sizes(PairsData* d, const uint8_t* data) {
+    d->flags = *data++;
+
+    if (d->flags & TB_SINGLE_VALUE) {
+        d->num_blocks = 0;
+        d->span = d->sparse_index_size = 0;
+        d->min_sym_len = *data++;
+        return data;
+    }
+
+    // The last group index is the number of positions in the table
+    uint64_t tb_size = d->group_idx[std::find(d->group_len, d->group_len + TB_PIECES, 0) - d->group_len];
+
+    d->block_size = 1ULL << *data++;
+    d->span = 1ULL << *data++;
+    d->sparse_index_size = (size_t)((tb_size + d->span - 1) / d->span);
+    uint8_t padding = *data++;
+    d->num_blocks = read_le<uint32_t>(data);
+    data += 4;
+    // Padding keeps a sparse index entry near the end from pointing past the
+    // block lengths
+    d->block_length_size = d->num_blocks + padding;
+    d->max_sym_len = *data++;
+    d->min_sym_len = *data++;
+    d->lowest_sym = data;
+    d->base64.resize(d->max_sym_len - d->min_sym_len + 1);
+
+    // Canonical Huffman: longer codes have lower values. base64[i] is the
+    // lowest code of length min_sym_len + i, and a code of that length
+    // left-aligned in 64 bits lies between base64[i] and base64[i - 1].
+    for (int i = (int)d->base64.size() - 2; i >= 0; --i) {
+        d->base64[i] = (d->base64[i + 1] + read_le<uint16_t>(d->lowest_sym + 2 * i)
+                        - read_le<uint16_t>(d->lowest_sym + 2 * (i + 1))) / 2;
+    }
+    for (size_t i = 0; i < d->base64.size(); ++i) {
+        d->base64[i] <<= 64 - i - d->min_sym_len;
+    }
+
+    data += d->base64.size() * 2;
+    d->symlen.resize(read_le<uint16_t>(data));
+    data += 2;
+    d->btree = data;
+
+    std::vector<bool> visited(d->symlen.size());
+    for (size_t sym = 0; sym < d->symlen.size(); ++sym) {
+        if (!visited[sym]) d->symlen[sym] = set_symlen(d, (int)sym, visited);
+    }
+
+    return data + d->symlen.size() * 3 + (d->symlen.size() & 1);
+}
+
+// DTZ files store values through per-outcome maps, read here for each file
+static const uint8_t* set_dtz_map(TBTable& e, const uint8_t* data, int max_file) {
+    e.map = data;
+    for (int f = 0; f <= max_file; ++f) {
+        PairsData* d = e.get(0, f);
+        if (!(d->flags & TB_MAPPED)) continue;
+
+        if (d->flags & TB_WIDE) {
+            data += (uintptr_t)data & 1; // Word alignment
+            for (int i = 0; i < 4; ++i) {
+                d->map_idx[i] = (uint16_t)((data - e.map) / 2 + 1);
+                data += 2 * read_le<uint16_t>(data) + 2;
+            }
+        } else {
+            for (int i = 0; i < 4; ++i) {
+                d->map_idx[i] = (uint16_t)(data - e.map + 1);
+                data += *data + 1;
             }
         }
-        if (!moves.empty()) result.best_move = moves[0];
-        return true;
     }
+    return data + ((uintptr_t)data & 1);
+}
+
+// Group the pieces as the encoder did and compute the index weight of each
+// group. Groups are encoded in a per-table order given by `order`: the
+// leading group at order[0] and, with pawns on both sides, the remaining
+// pawns at order[1].
+static void set_groups(const TBTable& e, PairsData* d, const int order[2], int file) {
+    int n = 0;
+    int first_len = e.has_pawns ? 0 : e.has_unique_pieces ? 3 : 2;
+    d->group_len[n] = 1;
+
+    for (int i = 1; i < e.piece_count; ++i) {
+        if (--first_len > 0 || d->pieces[i] == d->pieces[i - 1]) {
+            d->group_len[n]++;
+        } else {
+            d->group_len[++n] = 1;
+        }
+    }
+    d->group_len[++n] = 0;
+
+    bool pp = e.has_pawns && e.pawn_count[1]; // Pawns on both sides
+    int next = pp ? 2 : 1;
+    int free_squares = 64 - d->group_len[0] - (pp ? d->group_len[1] : 0);
+    uint64_t idx = 1;
+
+    for (int k = 0; next < n || k == order[0] || k == order[1]; ++k) {
+        if (k == order[0]) {
+            d->group_idx[0] = idx;
+            idx *= e.has_pawns ? LeadPawnsSize[d->group_len[0]][file]
+                 : e.has_unique_pieces ? 31332 : 462;
+        } else if (k == order[1]) {
+            d->group_idx[1] = idx;
+            idx *= Binomial[d->group_len[1]][48 - d->group_len[0]];
+        } else {
+            d->group_idx[next] = idx;
+            idx *= Binomial[d->group_len[next]][free_squares];
+            free_squares -= d->group_len[next++];
+        }
+    }
+    d->group_idx[n] = idx;
+}
+
+static bool parse_table(TBTable& e, const uint8_t* data) {
+    enum { SPLIT = 1, HAS_PAWNS = 2 };
+    if (e.has_pawns != bool(*data & HAS_PAWNS) || (e.key != e.key2) != bool(*data & SPLIT)) {
+        return false;
+    }
+    data++;
+
+    int sides = e.sides() == 2 && e.key != e.key2 ? 2 : 1;
+    int max_file = e.has_pawns ? FILE_D : FILE_A;
+    bool pp = e.has_pawns && e.pawn_count[1];
+
+    for (int f = 0; f <= max_file; ++f) {
+        for (int i = 0; i < sides; ++i) *e.get(i, f) = PairsData();
 
-    // K vs KQ
-    if (black_mat == SEE_VALUES[BQ] && white_mat == 0) {
-        result.score = -1000000;
-        result.dtz = 1;
-        MoveList moves;
-        generate_moves(pos, moves);
-        for (auto m : moves) {
-            if (m.captured_piece() == WK) {
-                result.best_move = m;
-                return true;
+        int order[2][2] = {{*data & 0xF, pp ? *(data + 1) & 0xF : 0xF},
+                           {*data >> 4, pp ? *(data + 1) >> 4 : 0xF}};
+        data += 1 + pp;
+
+        for (int k = 0; k < e.piece_count; ++k, ++data) {
+            for (int i = 0; i < sides; ++i) {
+                e.get(i, f)->pieces[k] = i ? *data >> 4 : *data & 0xF;
             }
         }
-        if (!moves.empty()) result.best_move = moves[0];
-        return true;
+
+        for (int i = 0; i < sides; ++i) set_groups(e, e.get(i, f), order[i], f);
     }
 
-    // KR vs K
-    if (white_mat == SEE_VALUES[WR] && black_mat == 0) {
-        result.score = 1000000;
-        result.dtz = 1;
-        MoveList moves;
-        generate_moves(pos, moves);
-        if (!moves.empty()) result.best_move = moves[0];
-        return true;
+    data += (uintptr_t)data & 1;
+
+    for (int f = 0; f <= max_file; ++f) {
+        for (int i = 0; i < sides; ++i) data = set_sizes(e.get(i, f), data);
     }
 
-    // K vs KR
-    if (black_mat == SEE_VALUES[BR] && white_mat == 0) {
-        result.score = -1000000;
-        result.dtz = 1;
-        MoveList moves;
-        generate_moves(pos, moves);
-        if (!moves.empty()) result.best_move = moves[0];
-        return true;
+    if (e.type == DTZ_TABLE) data = set_dtz_map(e, data, max_file);
+
+    for (int f = 0; f <= max_file; ++f) {
+        for (int i = 0; i < sides; ++i) {
+            PairsData* d = e.get(i, f);
+            d->sparse_index = data;
+            data += d->sparse_index_size * 6;
+        }
     }
 
+    for (int f = 0; f <= max_file; ++f) {
+        for (int i = 0; i < sides; ++i) {
+            PairsData* d = e.get(i, f);
+            d->block_length = data;
+            data += d->block_length_size * 2;
+        }
+    }
+
+    for (int f = 0; f <= max_file; ++f) {
+        for (int i = 0; i < sides; ++i) {
+            data = (const uint8_t*)(((uintptr_t)data + 0x3F) & ~(uintptr_t)0x3F); // 64-byte alignment
+            PairsData* d = e.get(i, f);
+            d->data = data;
+            data += (size_t)d->num_blocks * d->block_size;
+        }
+    }
+    return true;
+}
+
+// Pin the table for a probe, mapping and parsing the file if it is not
+// mapped. Returns false, without a pin, if the file cannot be used.
+static bool acquire(TBTable& e) {
+    e.users.fetch_add(1);
+    e.last_used.store(TBClock.fetch_add(1, std::memory_order_relaxed), std::memory_order_relaxed);
+    int state = e.state.load();
+    if (state == FILE_MAPPED) return true;
+
+    if (state == FILE_UNMAPPED || state == FILE_EVICTING) {
+        std::lock_guard<std::mutex> lock(TBMapMutex);
+        if (e.state.load() == FILE_UNMAPPED) {
+            const uint8_t* data = map_file(e);
+            if (data && !parse_table(e, data)) {
+                std::cout << "info string Syzygy: unexpected layout in " << e.name << std::endl;
+                munmap(e.base, e.mapping);
+                TBMappedBytes -= e.mapping;
+                e.base = nullptr;
+                data = nullptr;
+            }
+            e.state.store(data ? FILE_MAPPED : FILE_MISSING);
+        }
+        if (e.state.load() == FILE_MAPPED) return true;
+    }
+
+    e.users.fetch_sub(1);
     return false;
 }
+
+static void release(TBTable& e) {
+    e.users.fetch_sub(1);
+}
+
+// --- Decoding ---
+static int decompress_pairs(const PairsData* d, uint64_t idx) {
+    if (d->flags & TB_SINGLE_VALUE) return d->min_sym_len;
+
+    // Each block n holds block_length[n] + 1 values. The sparse index gives,
+    // for every span-th value, its block and its offset in that block; start
+    // from the nearest entry and walk to the block holding idx.
+    uint32_t k = (uint32_t)(idx / d->span);
+    uint32_t block = read_le<uint32_t>(d->sparse_index + 6 * k);
+    int offset = read_le<uint16_t>(d->sparse_index + 6 * k + 4);
+    offset += (int)(idx % d->span) - (int)(d->span / 2);
+
+    while (offset < 0) {
+        offset += read_le<uint16_t>(d->block_length + 2 * --block) + 1;
+    }
+    while (offset > read_le<uint16_t>(d->block_length + 2 * block)) {
+        offset -= read_le<uint16_t>(d->block_length + 2 * block++) + 1;
+    }
+
+    // Read symbols from the block until the one covering our offset
+    const uint8_t* ptr = d->data + (uint64_t)block * d->block_size;
+    uint64_t buf64 = read_be<uint64_t>(ptr);
+    ptr += 8;
+    int buf64_size = 64;
+    int sym;
+
+    while (true) {
+        int len = 0; // Code length - min_sym_len
+        while (buf64 < d->base64[len]) ++len;
+
+        sym = (int)((buf64 - d->base64[len]) >> (64 - len - d->min_sym_len));
+        sym += read_le<uint16_t>(d->lowest_sym + 2 * len);
+
+        if (offset < d->symlen[sym] + 1) break;
+
+        offset -= d->symlen[sym] + 1;
+        len += d->min_sym_len;
+        buf64 <<= len;
+        buf64_size -= len;
+
+        if (buf64_size <= 32) {
+            buf64_size += 32;
+            buf64 |= (uint64_t)read_be<uint32_t>(ptr) << (64 - buf64_size);
+            ptr += 4;
+        }
+    }
+
+    // The symbol expands to symlen[sym] + 1 values; descend the pair tree to
+    // the leaf holding ours
+    while (d->symlen[sym]) {
+        int left = btree_left(d, sym);
+        if (offset < d->symlen[left] + 1) {
+            sym = left;
+        } else {
+            offset -= d->symlen[left] + 1;
+            sym = btree_right(d, sym);
+        }
+    }
+    return btree_left(d, sym);
+}
+
+static int map_score(TBTable& e, int file, int value, WDLScore wdl) {
+    if (e.type == WDL_TABLE) return value - 2;
+
+    static const int WDL_MAP[] = {1, 3, 0, 2, 0};
+    PairsData* d = e.get(0, file);
+
+    if (d->flags & TB_MAPPED) {
+        int i = d->map_idx[WDL_MAP[wdl + 2]] + value;
+        value = (d->flags & TB_WIDE) ? read_le<uint16_t>(e.map + 2 * i) : e.map[i];
+    }
+
+    // Values may be stored in moves; return plies
+    if ((wdl == WDL_WIN && !(d->flags & TB_WIN_PLIES)) ||
+        (wdl == WDL_LOSS && !(d->flags & TB_LOSS_PLIES)) ||
+        wdl == WDL_CURSED_WIN || wdl == WDL_BLESSED_LOSS) {
+        value *= 2;
+    }
+    return value + 1;
+}
+
+static int probe_table(const Position& pos, TBTable& e, WDLScore wdl, ProbeState& state) {
+    int squares[TB_PIECES];
+    int pieces[TB_PIECES];
+    int size = 0, lead_pawns_count = 0;
+    Bitboard lead_pawns = 0;
+    int tb_file = 0;
+    uint64_t idx;
+
+    // Tables are stored with the first side of the name as White. Positions
+    // with the colors the other way round, and positions of symmetric
+    // material with Black to move, are looked up with colors swapped and
+    // the board flipped vertically.
+    bool symmetric_black_to_move = e.key == e.key2 && pos.side_to_move == BLACK;
+    bool black_stronger = material_key(pos) != e.key;
+    bool flip = symmetric_black_to_move || black_stronger;
+    int flip_color = flip ? 8 : 0;
+    int flip_squares = flip ? 56 : 0;
+    int stm = flip ^ (pos.side_to_move == BLACK);
+
+    // Pawn tables are split by the file of the leading pawn, the one with the
+    // largest MapPawns[] value
+    if (e.has_pawns) {
+        int pc = e.get(0, 0)->pieces[0] ^ flip_color;
+        lead_pawns = pos.piece_bitboards[(pc >> 3) ? BP : WP];
+        Bitboard b = lead_pawns;
+        while (b) squares[size++] = pop_bit(b) ^ flip_squares;
+        lead_pawns_count = size;
+
+        std::swap(squares[0], *std::max_element(squares, squares + lead_pawns_count, pawns_comp));
+        tb_file = edge_distance(file_of((Square)squares[0]));
+    }
+
+    // DTZ tables hold one side to move only
+    if (e.type == DTZ_TABLE) {
+        int flags = e.get(stm, tb_file)->flags;
+        if ((flags & TB_STM) != stm && !(e.key == e.key2 && !e.has_pawns)) {
+            state = PROBE_CHANGE_STM;
+            return 0;
+        }
+    }
+
+    Bitboard b = pos.occupancy_bitboards[BOTH] ^ lead_pawns;
+    while (b) {
+        Square sq = pop_bit(b);
+        squares[size] = sq ^ flip_squares;
+        pieces[size++] = tb_piece(pos.piece_of_square[sq]) ^ flip_color;
+    }
+
+    PairsData* d = e.get(stm, tb_file);
+
+    // Put the pieces in the order the table was encoded with
+    for (int i = lead_pawns_count; i < size - 1; ++i) {
+        for (int j = i + 1; j < size; ++j) {
+            if (d->pieces[i] == pieces[j]) {
+                std::swap(pieces[i], pieces[j]);
+                std::swap(squares[i], squares[j]);
+                break;
+            }
+        }
+    }
+
+    // Mirror so the leading piece is on files a-d
+    if (file_of((Square)squares[0]) > FILE_D) {
+        for (int i = 0; i < size; ++i) squares[i] = flip_file(squares[i]);
+    }
+
+    if (e.has_pawns) {
+        idx = LeadPawnIdx[lead_pawns_count][squares[0]];
+        std::stable_sort(squares + 1, squares + lead_pawns_count, pawns_comp);
+        for (int i = 1; i < lead_pawns_count; ++i) {
+            idx += Binomial[i][MapPawns[squares[i]]];
+        }
+    } else {
+        // Without pawns, also mirror the leading piece to ranks 1-4 and then
+        // below the a1-h8 diagonal
+        if (rank_of((Square)squares[0]) > RANK_4) {
+            for (int i = 0; i < size; ++i) squares[i] = flip_rank(squares[i]);
+        }
+
+        for (int i = 0; i < d->group_len[0]; ++i) {
+            if (!off_a1h8(squares[i])) continue;
+            if (off_a1h8(squares[i]) > 0) {
+                for (int j = i; j < size; ++j) {
+                    squares[j] = ((squares[j] >> 3) | (squares[j] << 3)) & 63;
+                }
+            }
+            break;
+        }
+
+        // Encode the leading group: the first three unique pieces together
+        // when there are enough of them, otherwise just the two kings
+        if (e.has_unique_pieces) {
+            int adjust1 = squares[1] > squares[0];
+            int adjust2 = (squares[2] > squares[0]) + (squares[2] > squares[1]);
+
+            if (off_a1h8(squares[0])) {
+                idx = (MapA1D1D4[squares[0]] * 63 + (squares[1] - adjust1)) * 62 + squares[2] - adjust2;
+            } else if (off_a1h8(squares[1])) {
+                idx = (6 * 63 + rank_of((Square)squares[0]) * 28 + MapB1H1H7[squares[1]]) * 62
+                    + squares[2] - adjust2;
+            } else if (off_a1h8(squares[2])) {
+                idx = 6 * 63 * 62 + 4 * 28 * 62 + rank_of((Square)squares[0]) * 7 * 28
+                    + (rank_of((Square)squares[1]) - adjust1) * 28 + MapB1H1H7[squares[2]];
+            } else {
+                idx = 6 * 63 * 62 + 4 * 28 * 62 + 4 * 7 * 28 + rank_of((Square)squares[0]) * 7 * 6
+                    + (rank_of((Square)squares[1]) - adjust1) * 6 + (rank_of((Square)squares[2]) - adjust2);
+            }
+        } else {
+            idx = MapKK[MapA1D1D4[squares[0]]][squares[1]];
+        }
+    }
+
+    // Encode the remaining groups: each as a combination of the squares not
+    // taken by earlier groups (the second group of pawns cannot use ranks 1
+    // and 8, hence the shift)
+    idx *= d->group_idx[0];
+    int* group_sq = squares + d->group_len[0];
+    bool remaining_pawns = e.has_pawns && e.pawn_count[1];
+
+    for (int next = 1; d->group_len[next]; ++next) {
+        std::stable_sort(group_sq, group_sq + d->group_len[next]);
+        uint64_t n = 0;
+        for (int i = 0; i < d->group_len[next]; ++i) {
+            int adjust = (int)std::count_if(squares, group_sq, [&](int s) { return group_sq[i] > s; });
+            n += Binomial[i + 1][group_sq[i] - adjust - 8 * remaining_pawns];
+        }
+        remaining_pawns = false;
+        idx += n * d->group_idx[next];
+        group_sq += d->group_len[next];
+    }
+
+    return map_score(e, tb_file, decompress_pairs(d, idx), wdl);
+}
+
+static int probe_table(const Position& pos, TableType type, ProbeState& state, WDLScore wdl = WDL_DRAW) {
+    if (popcnt(pos.occupancy_bitboards[BOTH]) == 2) return WDL_DRAW; // KvK
+
+    auto it = TBIndex.find(material_key(pos));
+    if (it == TBIndex.end()) {
+        state = PROBE_FAIL;
+        return 0;
+    }
+    TBTable& e = type == WDL_TABLE ? *it->second.wdl : *it->second.dtz;
+    if (!acquire(e)) {
+        state = PROBE_FAIL;
+        return 0;
+    }
+    int value = probe_table(pos, e, wdl, state);
+    release(e);
+    return value;
+}
+
+// --- Probing With Captures ---
+static bool is_zeroing(Move move) {
+    return move.is_capture() || move.moving_piece() == WP || move.moving_piece() == BP;
+}
+
+// DTZ of the move before a zeroing move, given the WDL after it
+static int dtz_before_zeroing(WDLScore wdl) {
+    return wdl == WDL_WIN ? 1 : wdl == WDL_CURSED_WIN ? 101 : wdl == WDL_BLESSED_LOSS ? -101 : wdl == WDL_LOSS ? -1 : 0;
+}
+
+static int sign_of(int v) { return (0 < v) - (v < 0); }
+
+// Tables assume no en passant rights and that the best capture is no better
+// than the stored value, so captures (and, for DTZ, pawn moves) are searched
+// first and the table consulted for the rest
+static WDLScore search_wdl(Position& pos, ProbeState& state, bool check_zeroing_moves) {
+    WDLScore best = WDL_LOSS;
+    MoveList moves;
+    generate_legal_moves(pos, moves);
+    size_t move_count = 0;
+
+    for (Move move : moves) {
+        if (!move.is_capture() && (!check_zeroing_moves || !is_zeroing(move))) continue;
+        move_count++;
+
+        pos.make_move(move);
+        WDLScore value = (WDLScore)-search_wdl(pos, state, false);
+        pos.unmake_move(move);
+
+        if (state == PROBE_FAIL) return WDL_DRAW;
+
+        if (value > best) {
+            best = value;
+            if (value >= WDL_WIN) {
+                state = PROBE_ZEROING_BEST_MOVE;
+                return value;
+            }
+        }
+    }
+
+    // With every legal move already searched the table is not needed, and
+    // could be wrong, as with en passant rights
+    bool no_more_moves = move_count && move_count == moves.size();
+    WDLScore value;
+    if (no_more_moves) {
+        value = best;
+    } else {
+        value = (WDLScore)probe_table(pos, WDL_TABLE, state);
+        if (state == PROBE_FAIL) return WDL_DRAW;
+    }
+
+    if (best >= value) {
+        state = best > WDL_DRAW || no_more_moves ? PROBE_ZEROING_BEST_MOVE : PROBE_OK;
+        return best;
+    }
+    state = PROBE_OK;
+    return value;
+}
+
+static WDLScore probe_wdl_score(Position& pos, ProbeState& state) {
+    state = PROBE_OK;
+    return search_wdl(pos, state, false);
+}
+
+// Distance to zeroing the 50-move counter in plies, signed by the result:
+// positive when winning, negative when losing and 0 for draws
+static int probe_dtz(Position& pos, ProbeState& state) {
+    state = PROBE_OK;
+    WDLScore wdl = search_wdl(pos, state, true);
+
+    if (state == PROBE_FAIL || wdl == WDL_DRAW) return 0;
+    if (state == PROBE_ZEROING_BEST_MOVE) return dtz_before_zeroing(wdl);
+
+    int dtz = probe_table(pos, DTZ_TABLE, state, wdl);
+    if (state == PROBE_FAIL) return 0;
+
+    if (state != PROBE_CHANGE_STM) {
+        return (dtz + 100 * (wdl == WDL_BLESSED_LOSS || wdl == WDL_CURSED_WIN)) * sign_of(wdl);
+    }
+
+    // The table holds the other side to move: search one ply and take the
+    // best move's DTZ
+    int min_dtz = INT_MAX;
+    MoveList moves;
+    generate_legal_moves(pos, moves);
+    for (Move move : moves) {
+        bool zeroing = is_zeroing(move);
+        pos.make_move(move);
+
+        // For a zeroing move the DTZ before it is what counts; the WDL after
+        // it gives the sign
+        dtz = zeroing ? -dtz_before_zeroing(search_wdl(pos, state, false)) : -probe_dtz(pos, state);
+
+        if (dtz == 1 && pos.is_check()) {
+            MoveList replies;
+            generate_legal_moves(pos, replies);
+            if (replies.empty()) min_dtz = 1; // Mate
+        }
+
+        if (!zeroing) dtz += sign_of(dtz);
+        if (dtz < min_dtz && sign_of(dtz) == sign_of(wdl)) min_dtz = dtz;
+
+        pos.unmake_move(move);
+        if (state == PROBE_FAIL) return 0;
+    }
+
+    return min_dtz == INT_MAX ? -1 : min_dtz; // No legal moves: mated
+}
+
+// --- Public Interface ---
+bool probe_wdl(Position& pos, WDLScore& wdl) {
+    ProbeState state;
+    wdl = probe_wdl_score(pos, state);
+    return state != PROBE_FAIL;
+}
+
+bool probe_syzygy(Position& pos, TBResult& result) {
+    if (!TB_LARGEST || pos.castling_rights || popcnt(pos.occupancy_bitboards[BOTH]) > TB_LARGEST) {
+        return false;
+    }
+
+    MoveList moves;
+    generate_legal_moves(pos, moves);
+    if (moves.empty()) return false;
+
+    int cnt50 = pos.halfmove_clock;
+    bool rep = pos.is_repetition(pos.halfmove_clock); // Any earlier occurrence
+    int best_rank = INT_MIN;
+    int best_dtz = 0;
+
+    for (Move move : moves) {
+        ProbeState state;
+        int dtz;
+        pos.make_move(move);
+
+        if (pos.halfmove_clock == 0) {
+            dtz = dtz_before_zeroing((WDLScore)-probe_wdl_score(pos, state));
+        } else {
+            dtz = -probe_dtz(pos, state);
+            dtz = dtz > 0 ? dtz + 1 : dtz < 0 ? dtz - 1 : 0;
+        }
+
+        if (dtz == 2 && pos.is_check()) {
+            MoveList replies;
+            generate_legal_moves(pos, replies);
+            if (replies.empty()) dtz = 1; // Mate
+        }
+
+        pos.unmake_move(move);
+        if (state == PROBE_FAIL) return false;
+
+        // Wins that convert inside the 50-move rule rank equal, as do losses
+        // that cannot be dragged past it; otherwise the 50-move count decides
+        int rank = dtz > 0 ? (dtz + cnt50 <= 99 && !rep ? 1000 : 1000 - (dtz + cnt50))
+                 : dtz < 0 ? (-dtz * 2 + cnt50 < 100 ? -1000 : -1000 + (-dtz + cnt50))
+                 : 0;
+
+        // Among equal ranks, win fastest and lose slowest
+        if (rank > best_rank || (rank == best_rank && dtz != 0 && dtz < best_dtz)) {
+            best_rank = rank;
+            best_dtz = dtz;
+            result.best_move = move;
+        }
+    }
+
+    // Cursed wins and blessed losses get small scores that grow as the real
+    // result comes closer
+    result.dtz = best_dtz;
+    result.score = best_rank >= 900 ? TB_WIN_SCORE
+                 : best_rank > 0 ? std::max(3, best_rank - 800) / 2
+                 : best_rank == 0 ? 0
+                 : best_rank > -900 ? std::min(-3, best_rank + 800) / 2
+                 : -TB_WIN_SCORE;
+    return true;
+}
+
+// --- Initialization ---
+static void init_encoding() {
+    int code = 0;
+    for (int sq = 0; sq < 64; ++sq) {
+        if (off_a1h8(sq) < 0) MapB1H1H7[sq] = code++;
+    }
+
+    // The a1-d1-d4 triangle, diagonal squares last
+    std::vector<int> diagonal;
+    code = 0;
+    for (int sq = A1; sq <= D4; ++sq) {
+        if (off_a1h8(sq) < 0 && file_of((Square)sq) <= FILE_D) {
+            MapA1D1D4[sq] = code++;
+        } else if (!off_a1h8(sq) && file_of((Square)sq) <= FILE_D) {
+            diagonal.push_back(sq);
+        }
+    }
+    for (int sq : diagonal) MapA1D1D4[sq] = code++;
+
+    // The 462 legal placements of two kings with the first in the a1-d1-d4
+    // triangle; with the first on the diagonal the second may not be above it
+    std::vector<std::pair<int, int>> both_on_diagonal;
+    code = 0;
+    for (int idx = 0; idx < 10; ++idx) {
+        for (int s1 = A1; s1 <= D4; ++s1) {
+            if (MapA1D1D4[s1] != idx || (!idx && s1 != B1)) continue;
+            for (int s2 = 0; s2 < 64; ++s2) {
+                if ((KING_ATTACKS[s1] | (1ULL << s1)) & (1ULL << s2)) continue;
+                if (!off_a1h8(s1) && off_a1h8(s2) > 0) continue;
+                if (!off_a1h8(s1) && !off_a1h8(s2)) {
+                    both_on_diagonal.emplace_back(idx, s2);
+                } else {
+                    MapKK[idx][s2] = code++;
+                }
+            }
+        }
+    }
+    for (auto [idx, s2] : both_on_diagonal) MapKK[idx][s2] = code++;
+
+    Binomial[0][0] = 1;
+    for (int n = 1; n < 64; ++n) {
+        for (int k = 0; k < 6 && k <= n; ++k) {
+            Binomial[k][n] = (k > 0 ? Binomial[k - 1][n - 1] : 0) + (k < n ? Binomial[k][n - 1] : 0);
+        }
+    }
+
+    // MapPawns[] numbers a2-h7 from the edges inwards and, on each file pair,
+    // from rank 2 up: the leading pawn is the one with the largest value
+    int available_squares = 47;
+    for (int lead_pawns_count = 1; lead_pawns_count <= 5; ++lead_pawns_count) {
+        for (int f = FILE_A; f <= FILE_D; ++f) {
+            uint64_t idx = 0;
+            for (int r = RANK_2; r <= RANK_7; ++r) {
+                int sq = 8 * r + f;
+                if (lead_pawns_count == 1) {
+                    MapPawns[sq] = available_squares--;
+                    MapPawns[flip_file(sq)] = available_squares--;
+                }
+                LeadPawnIdx[lead_pawns_count][sq] = idx;
+                idx += Binomial[lead_pawns_count - 1][MapPawns[sq]];
+            }
+            LeadPawnsSize[lead_pawns_count][f] = idx;
+        }
+    }
+}
+
+// Table names are "K", the first side's pieces strongest first, "v", then
+// the same for the other side, like "KRPvKR"
+static bool valid_table_name(const std::string& name) {
+    size_t v = name.find('v');
+    if (v == std::string::npos || name.size() - 1 > (size_t)TB_PIECES) return false;
+    for (const std::string& side : {name.substr(0, v), name.substr(v + 1)}) {
+        if (side.empty() || side[0] != 'K') return false;
+        int last = QUEEN;
+        for (size_t i = 1; i < side.size(); ++i) {
+            const char* p = std::strchr(TB_PIECE_CHARS, side[i]);
+            if (!p || !side[i] || p - TB_PIECE_CHARS > last) return false;
+            last = (int)(p - TB_PIECE_CHARS);
+        }
+    }
+    return true;
+}
+
+// Register the WDL and DTZ tables for a name like "KRPvKR"
+static void add_table(const std::string& name) {
+    int counts[2][5] = {};
+    int side = 0;
+    int piece_count = 0;
+    for (char ch : name) {
+        if (ch == 'v') {
+            side = 1;
+            continue;
+        }
+        piece_count++;
+        const char* p = std::strchr(TB_PIECE_CHARS, ch);
+        if (p - TB_PIECE_CHARS < KING) counts[side][p - TB_PIECE_CHARS]++;
+    }
+    if (TBIndex.count(material_key(counts))) return; // Already found in an earlier directory
+
+    auto wdl = std::make_unique<TBTable>();
+    wdl->type = WDL_TABLE;
+    wdl->name = name;
+    wdl->key = material_key(counts);
+    std::swap(counts[WHITE], counts[BLACK]);
+    wdl->key2 = material_key(counts);
+    std::swap(counts[WHITE], counts[BLACK]);
+    wdl->piece_count = piece_count;
+    wdl->has_pawns = counts[WHITE][PAWN] || counts[BLACK][PAWN];
+    wdl->has_unique_pieces = false;
+    for (int c = 0; c < 2; ++c) {
+        for (int pt = PAWN; pt < KING; ++pt) {
+            if (counts[c][pt] == 1) wdl->has_unique_pieces = true;
+        }
+    }
+
+    // The leading color is the one with fewer pawns, White on a tie
+    bool white_leads = !counts[BLACK][PAWN] || (counts[WHITE][PAWN] && counts[BLACK][PAWN] >= counts[WHITE][PAWN]);
+    wdl->pawn_count[0] = (uint8_t)counts[white_leads ? WHITE : BLACK][PAWN];
+    wdl->pawn_count[1] = (uint8_t)counts[white_leads ? BLACK : WHITE][PAWN];
+
+    auto dtz = std::make_unique<TBTable>();
+    dtz->type = DTZ_TABLE;
+    dtz->name = name;
+    dtz->key = wdl->key;
+    dtz->key2 = wdl->key2;
+    dtz->piece_count = wdl->piece_count;
+    dtz->has_pawns = wdl->has_pawns;
+    dtz->has_unique_pieces = wdl->has_unique_pieces;
+    dtz->pawn_count[0] = wdl->pawn_count[0];
+    dtz->pawn_count[1] = wdl->pawn_count[1];
+
+    TB_LARGEST = std::max(TB_LARGEST, piece_count);
+    TBEntry entry = {wdl.get(), dtz.get()};
+    TBIndex[wdl->key] = entry;
+    TBIndex[wdl->key2] = entry;
+    TBTables.push_back(std::move(wdl));
+    TBTables.push_back(std::move(dtz));
+}
+
+static void unmap_all() {
+    std::lock_guard<std::mutex> lock(TBMapMutex);
+    for (auto& e : TBTables) {
+        if (e->base) munmap(e->base, e->mapping);
+    }
+    TBTables.clear();
+    TBIndex.clear();
+    TBMappedBytes = 0;
+}
+
+int syzygy_init(const std::string& paths) {
+    static bool encoding_ready = false;
+    if (!encoding_ready) {
+        init_encoding();
+        encoding_ready = true;
+    }
+
+    unmap_all();
+    TB_LARGEST = 0;
+    TBPaths = paths == "<empty>" ? "" : paths;
+    if (TBPaths.empty()) return 0;
+
+    // One directory listing per path; nothing is opened until it is probed
+    std::stringstream ss(TBPaths);
+    std::string dir;
+    while (std::getline(ss, dir, ':')) {
+        if (dir.empty()) continue;
+        std::error_code ec;
+        for (const auto& file : std::filesystem::directory_iterator(dir, ec)) {
+            if (file.path().extension() != ".rtbw") continue;
+            std::string name = file.path().stem().string();
+            if (valid_table_name(name)) add_table(name);
+        }
+    }
+
+    size_t found = TBTables.size() / 2;
+    std::cout << "info string Syzygy: found " << found << " tablebases, up to " << TB_LARGEST << " pieces" << std::endl;
+    return (int)found;
+}
+
+void syzygy_set_map_limit(size_t bytes) {
+    std::lock_guard<std::mutex> lock(TBMapMutex);
+    TBMapLimit = bytes;
+    evict_for(0);
+}
+
+size_t syzygy_mapped_bytes() {
+    std::lock_guard<std::mutex> lock(TBMapMutex);
+    return TBMappedBytes;
+}
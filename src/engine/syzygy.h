@@ -1,6 +1,7 @@
 #pragma once
 
 #include "position.h"
+#include <string>
 
 struct TBResult {
     Move best_move;
@@ -8,4 +9,37 @@ struct TBResult {
     int dtz;
 };
 
+// Win/draw/loss from the side to move's point of view. Cursed wins and
+// blessed losses are wins and losses that the 50-move rule turns into draws.
+enum WDLScore {
+    WDL_LOSS = -2,
+    WDL_BLESSED_LOSS = -1,
+    WDL_DRAW = 0,
+    WDL_CURSED_WIN = 1,
+    WDL_WIN = 2
+};
+
+// Largest piece count (kings included) with a table on the current path,
+// 0 when no tables are available
+extern int TB_LARGEST;
+
+// Look for .rtbw/.rtbz files in `paths`, a list of directories separated by
+// ':'. The directories are only listed here; each file is mapped on the
+// first probe of its material. Passing an empty string or "<empty>"
+// disables the tablebases. Returns the number of WDL tables found.
+int syzygy_init(const std::string& paths);
+
+// Cap on the bytes of table files mapped at once, 0 for no cap. Past it the
+// least recently probed files are unmapped; files in use by a probe are
+// never unmapped, so the cap can be exceeded while all of them are busy.
+void syzygy_set_map_limit(size_t bytes);
+size_t syzygy_mapped_bytes();
+
+// WDL probe for use inside the search. Only meaningful right after a capture
+// or pawn move (halfmove clock 0) and without castling rights; returns false
+// if the position is not covered.
+bool probe_wdl(Position& pos, WDLScore& wdl);
+
+// Root probe: ranks the legal moves by DTZ and returns the one that keeps
+// the best result under the 50-move rule, winning fastest or losing slowest
 bool probe_syzygy(Position& pos, TBResult& result);
@@ -0,0 +1,77 @@
+#include "timeman.h"
+#include <algorithm>
+#include <climits>
+
+// Global time manager, owned by the main search thread
+TimeManager Time;
+
+// Assumed number of moves left when the GUI does not send movestogo
+const int DEFAULT_MOVES_TO_GO = 40;
+const int MAX_MOVES_TO_GO = 50;
+
+TimeManager::TimeManager()
+    : move_overhead(DEFAULT_MOVE_OVERHEAD), optimum_ms(INT_MAX), maximum_ms(INT_MAX), use_clock(false),
+      last_best_move(0), best_move_changes(0), stable_iterations(0), last_score(0), iterations(0) {}
+
+void TimeManager::init(const SearchLimits& limits, Color us) {
+    start_time = std::chrono::steady_clock::now();
+    last_best_move = Move(0);
+    best_move_changes = 0;
+    stable_iterations = 0;
+    last_score = 0;
+    iterations = 0;
+
+    optimum_ms = maximum_ms = limits.movetime;
+    int clock = (us == WHITE) ? limits.wtime : limits.btime;
+    int inc = (us == WHITE) ? limits.winc : limits.binc;
+    use_clock = clock > 0;
+    if (!use_clock) return;
+
+    int moves_to_go = limits.movestogo > 0 ? std::min(limits.movestogo, MAX_MOVES_TO_GO) : DEFAULT_MOVES_TO_GO;
+    int64_t available = std::max<int64_t>(1, (int64_t)clock - move_overhead);
+
+    // Spread the remaining time over the expected moves and spend most of
+    // the increment now. The hard limit lets an unstable search borrow from
+    // later moves but never touches the last fifth of the clock (or tenth
+    // right before a time control).
+    int64_t optimum = available / moves_to_go + (int64_t)inc * 3 / 4;
+    int64_t reserve = moves_to_go == 1 ? available / 10 : available / 5;
+    int64_t maximum = std::min(optimum * 4, available - reserve);
+
+    maximum_ms = std::max<int64_t>(1, std::min<int64_t>(maximum, limits.movetime));
+    optimum_ms = std::max<int64_t>(1, std::min(optimum, maximum_ms));
+}
+
+int64_t TimeManager::elapsed() const {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start_time).count();
+}
+
+bool TimeManager::stop_after_iteration(Move best_move, int score, double best_move_effort) {
+    iterations++;
+    if (iterations > 1 && best_move != last_best_move) {
+        best_move_changes++;
+        stable_iterations = 0;
+    } else {
+        stable_iterations++;
+    }
+    int score_drop = iterations > 1 ? last_score - score : 0;
+    last_best_move = best_move;
+    last_score = score;
+
+    if (!use_clock) return false;
+
+    // A best move that keeps changing or a falling score needs more time to
+    // resolve; a move that has survived several iterations needs less
+    double scale = 1.0;
+    if (stable_iterations == 0) scale *= 1.0 + 0.3 * std::min(best_move_changes, 3);
+    else if (stable_iterations >= 4) scale *= 0.7;
+    if (score_drop > 20) scale *= 1.0 + std::min(score_drop, 150) / 150.0;
+    // When nearly all the effort went into one move, the alternatives were
+    // refuted quickly and are unlikely to overtake it
+    if (best_move_effort > 0.9) scale *= 0.8;
+
+    // The next iteration usually costs more than all previous ones together,
+    // so don't start one past half of the adjusted budget
+    int64_t soft_limit = std::min<int64_t>((int64_t)(optimum_ms * scale), maximum_ms);
+    return elapsed() >= soft_limit / 2;
+}
@@ -0,0 +1,49 @@
+#ifndef TIMEMAN_H
+#define TIMEMAN_H
+
+#include "types.h"
+#include <chrono>
+#include <cstdint>
+
+// Milliseconds reserved per move for GUI and network latency
+const int DEFAULT_MOVE_OVERHEAD = 30;
+
+// Time Manager
+// Turns the UCI clock into two budgets: `optimum`, the target the main thread
+// compares against between iterations (scaled by how settled the search
+// looks), and `maximum`, the hard deadline enforced inside the search.
+class TimeManager {
+public:
+    TimeManager();
+
+    // Start the clock and derive budgets for the side to move
+    void init(const SearchLimits& limits, Color us);
+
+    int64_t elapsed() const;
+    int64_t optimum() const { return optimum_ms; }
+    int64_t maximum() const { return maximum_ms; }
+
+    // Called after each completed iteration with the share of the main
+    // thread's nodes spent below the best move. Returns true if the next
+    // iteration should not be started.
+    bool stop_after_iteration(Move best_move, int score, double best_move_effort);
+
+    int move_overhead;
+
+private:
+    std::chrono::steady_clock::time_point start_time;
+    int64_t optimum_ms;
+    int64_t maximum_ms;
+    bool use_clock; // false for fixed movetime, where only the deadline applies
+
+    // Iteration history for the soft stop
+    Move last_best_move;
+    int best_move_changes;
+    int stable_iterations;
+    int last_score;
+    int iterations;
+};
+
+extern TimeManager Time;
+
+#endif // TIMEMAN_H
@@ -1,13 +1,33 @@
 #include "tt.h"
-#include <cstring> // For memset
-
-// Extern history table for halving on age overflow
-extern int HISTORY_TABLE[12][64];
 
 // Global instance of the TranspositionTable
 TranspositionTable TT;
 
-TranspositionTable::TranspositionTable() : table(nullptr), num_entries(0), current_age(0) {}
+// --- Entry Packing ---
+// bits  0-25: move (ordering hint bits dropped)
+// bits 26-47: score + SCORE_BIAS
+// bits 48-55: depth
+// bits 56-57: flags
+// bits 58-63: age
+const uint32_t MOVE_MASK = 0x03FFFFFF;
+const int32_t SCORE_BIAS = 1 << 21;
+const uint8_t AGE_MASK = 0x3F;
+
+static uint64_t pack(uint32_t move, int32_t score, int8_t depth, uint8_t flags, uint8_t age) {
+    return (uint64_t)(move & MOVE_MASK)
+         | ((uint64_t)(uint32_t)(score + SCORE_BIAS) << 26)
+         | ((uint64_t)(uint8_t)depth << 48)
+         | ((uint64_t)(flags & 3) << 56)
+         | ((uint64_t)(age & AGE_MASK) << 58);
+}
+
+static uint32_t data_move(uint64_t data) { return (uint32_t)(data & MOVE_MASK); }
+static int32_t data_score(uint64_t data) { return (int32_t)((data >> 26) & 0x3FFFFF) - SCORE_BIAS; }
+static int8_t data_depth(uint64_t data) { return (int8_t)(uint8_t)(data >> 48); }
+static uint8_t data_flags(uint64_t data) { return (uint8_t)((data >> 56) & 3); }
+static uint8_t data_age(uint64_t data) { return (uint8_t)(data >> 58); }
+
+TranspositionTable::TranspositionTable() : table(nullptr), num_clusters(0), current_age(0) {}
 
 TranspositionTable::~TranspositionTable() {
     delete[] table;
@@ -15,68 +35,74 @@ TranspositionTable::~TranspositionTable() {
 
 void TranspositionTable::resize(size_t mb_size) {
     delete[] table;
-    num_entries = (mb_size * 1024 * 1024) / sizeof(TTEntry);
-    table = new TTEntry[num_entries];
+    num_clusters = (mb_size * 1024 * 1024) / sizeof(TTCluster);
+    table = new TTCluster[num_clusters];
     clear();
 }
 
 void TranspositionTable::clear() {
-    if (table) {
-        memset(table, 0, num_entries * sizeof(TTEntry));
+    for (size_t i = 0; i < num_clusters; ++i) {
+        for (TTEntry& e : table[i].entries) {
+            e.check.store(0, std::memory_order_relaxed);
+            e.data.store(0, std::memory_order_relaxed);
+        }
     }
+    current_age = 0;
 }
 
 void TranspositionTable::increment_age() {
-    uint8_t old_age = current_age;
-    current_age++;
-    if (current_age < old_age) { // overflow
-        // Halve history table
-        for (int i = 0; i < 12; ++i) {
-            for (int j = 0; j < 64; ++j) {
-                HISTORY_TABLE[i][j] >>= 1;
-            }
-        }
-    }
+    current_age = (current_age + 1) & AGE_MASK;
+}
+
+// Map the key onto a cluster with a multiply-high instead of a modulo
+TTCluster* TranspositionTable::cluster_for(uint64_t key) const {
+    __extension__ typedef unsigned __int128 uint128;
+    return &table[(size_t)(((uint128)key * num_clusters) >> 64)];
 }
 
-TTEntry* TranspositionTable::probe(uint64_t key) {
-    if (!table) return nullptr;
-    TTEntry* entry = &table[key % num_entries];
-    if (entry->key == key) {
-        return entry;
+bool TranspositionTable::probe(uint64_t key, TTData& out) const {
+    if (!table) return false;
+    TTCluster* cluster = cluster_for(key);
+
+    for (const TTEntry& e : cluster->entries) {
+        uint64_t data = e.data.load(std::memory_order_relaxed);
+        if (data != 0 && (e.check.load(std::memory_order_relaxed) ^ data) == key) {
+            out.move = data_move(data);
+            out.score = data_score(data);
+            out.depth = data_depth(data);
+            out.flags = data_flags(data);
+            return true;
+        }
     }
-    return nullptr;
+    return false;
 }
 
 void TranspositionTable::store(uint64_t key, uint32_t move, int32_t score, int8_t depth, uint8_t flags) {
     if (!table) return;
-    TTEntry* entry = &table[key % num_entries];
+    TTCluster* cluster = cluster_for(key);
 
-    // Replacement policy: Prefer deeper; if tie use age; tie-break deterministic
-    bool replace = false;
-    if (entry->key == 0) {
-        replace = true; // Empty entry
-    } else if (depth > entry->depth) {
-        replace = true; // Deeper
-    } else if (depth == entry->depth) {
-        if (entry->age != current_age) {
-            replace = true; // Age tie
-        } else {
-            // Tie-break: ((new.key ^ old.key) & 0xFFFFFFFF) < ((old.key ^ new.key) & 0xFFFFFFFF)
-            uint32_t new_xor = (key ^ entry->key) & 0xFFFFFFFF;
-            uint32_t old_xor = (entry->key ^ key) & 0xFFFFFFFF;
-            if (new_xor < old_xor) {
-                replace = true;
-            }
+    // Replacement policy: reuse the slot holding this key (or an empty one);
+    // otherwise evict the entry that is shallowest once each search
+    // generation of age counts as 8 plies of depth.
+    TTEntry* replace = &cluster->entries[0];
+    int replace_value = 1 << 30;
+    for (TTEntry& e : cluster->entries) {
+        uint64_t data = e.data.load(std::memory_order_relaxed);
+        if (data == 0 || (e.check.load(std::memory_order_relaxed) ^ data) == key) {
+            // Keep the old move if we have nothing better to store
+            if (data != 0 && move == 0) move = data_move(data);
+            replace = &e;
+            break;
+        }
+        int relative_age = (current_age - data_age(data)) & AGE_MASK;
+        int value = data_depth(data) - 8 * relative_age;
+        if (value < replace_value) {
+            replace_value = value;
+            replace = &e;
         }
     }
 
-    if (replace) {
-        entry->key = key;
-        entry->move = move;
-        entry->score = score;
-        entry->depth = depth;
-        entry->flags = flags;
-        entry->age = current_age;
-    }
+    uint64_t data = pack(move, score, depth, flags, current_age);
+    replace->check.store(key ^ data, std::memory_order_relaxed);
+    replace->data.store(data, std::memory_order_relaxed);
 }
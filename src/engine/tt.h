@@ -3,17 +3,32 @@
 
 #include "types.h"
 #include "move.h"
+#include <atomic>
 
-// Transposition Table Entry
-struct TTEntry {
-    uint64_t key;     // Zobrist hash key
-    uint32_t move;         // Best move found from this position
+// Decoded transposition table data, returned by value from probe()
+struct TTData {
+    uint32_t move;    // Best move found from this position
     int32_t score;    // Evaluation score (centipawns)
-    int8_t depth;    // Search depth at which this entry was stored
+    int8_t depth;     // Search depth at which this entry was stored
     uint8_t flags;    // EXACT, LOWERBOUND, UPPERBOUND
-    uint8_t age;      // For replacement policy
-    uint8_t pad[7]; // For 32-byte alignment
-} __attribute__((aligned(64)));
+};
+
+// Transposition Table Entry (16 bytes)
+// `data` packs move, score, depth, flags and age into one word; `check` holds
+// key ^ data. A reader accepts the entry only if check ^ data reproduces its
+// key, which both verifies the position and rejects entries torn by a
+// concurrent write, so no locks are needed between search threads.
+struct TTEntry {
+    std::atomic<uint64_t> check;
+    std::atomic<uint64_t> data;
+};
+
+// Four entries share one cache line and form a replacement bucket
+const int TT_CLUSTER_SIZE = 4;
+
+struct alignas(64) TTCluster {
+    TTEntry entries[TT_CLUSTER_SIZE];
+};
 
 // Transposition Table
 class TranspositionTable {
@@ -26,15 +41,17 @@ public:
     void increment_age();
 
     // Probe the TT for an entry
-    TTEntry* probe(uint64_t key);
+    bool probe(uint64_t key, TTData& out) const;
 
     // Store an entry in the TT
     void store(uint64_t key, uint32_t move, int32_t score, int8_t depth, uint8_t flags);
 
 private:
-    TTEntry* table;
-    size_t num_entries;
+    TTCluster* table;
+    size_t num_clusters;
     uint8_t current_age;
+
+    TTCluster* cluster_for(uint64_t key) const;
 };
 
 extern TranspositionTable TT;
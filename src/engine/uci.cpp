@@ -32,7 +32,8 @@ ChessWizardOptions OPTIONS = {
     .tt_size_mb = 32,
     .multi_pv = 1,
     .resign_threshold = 0.01,
-    .seed = 0
+    .seed = 0,
+    .threads = 1
 };
 
 Book OPENING_BOOK;
@@ -42,12 +43,14 @@ std::string BOOK_PATH_BUFFER;
 void init_all() {
     init_attacks();
     init_zobrist_keys();
+    init_psqt();
     TT.resize(OPTIONS.tt_size_mb);
 }
 
 // --- C-API Implementation ---
 extern "C" SearchResult chess_wizard_suggest_move(const char* fen_or_moves, uint32_t max_time_ms, uint8_t max_depth, const ChessWizardOptions* opts) {
-    Position pos;
+    StateStack states;
+    Position pos(states);
     pos.set_from_fen(std::string(fen_or_moves));
 
     SearchLimits limits;
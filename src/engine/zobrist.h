@@ -18,6 +18,20 @@ private:
 };
 
 extern ZobristKeys Zobrist;
-extern uint64_t ZOBRIST_HISTORY[MAX_PLY];
+
+// Keys of the Polyglot opening book format, taken from its fixed Random64
+// table and laid out by the engine's piece and castling encodings. Unlike
+// the keys above, the en passant key only counts when a pawn of the side to
+// move stands ready to make the capture, and the side key marks White.
+struct PolyglotKeys {
+    std::array<std::array<uint64_t, 64>, 12> piece_keys; // [piece][square]
+    std::array<uint64_t, 16> castling_keys; // XOR of one key per right held
+    std::array<uint64_t, 8> en_passant_keys; // [file]
+    uint64_t side_to_move_key; // XORed if white to move
+
+    PolyglotKeys();
+};
+
+extern PolyglotKeys Polyglot;
 
 void init_zobrist_keys();
@@ -1,64 +1,107 @@
 #include "book.h"
-#include <fstream>
+#include "position.h"
+#include "movegen.h"
 #include <iostream>
 #include <algorithm>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
-// Polyglot books are big-endian, so we need a byte-swapping function
-uint64_t swap_uint64(uint64_t n) {
-    n = ((n & 0x00000000FFFFFFFF) << 32) | ((n & 0xFFFFFFFF00000000) >> 32);
-    n = ((n & 0x0000FFFF0000FFFF) << 16) | ((n & 0xFFFF0000FFFF0000) >> 16);
-    n = ((n & 0x00FF00FF00FF00FF) << 8) | ((n & 0xFF00FF00FF00FF00) >> 8);
+// Polyglot books are big-endian; fields are decoded byte by byte on access
+template <typename T>
+static T read_be(const unsigned char* p) {
+    T n = 0;
+    for (size_t i = 0; i < sizeof(T); ++i) n = (n << 8) | p[i];
     return n;
 }
 
-uint16_t swap_uint16(uint16_t n) {
-    return (n << 8) | (n >> 8);
+Book::~Book() {
+    unmap();
 }
 
-uint32_t swap_uint32(uint32_t n) {
-    n = ((n & 0x0000FFFF) << 16) | ((n & 0xFFFF0000) >> 16);
-    n = ((n & 0x00FF00FF) << 8) | ((n & 0xFF00FF00) >> 8);
-    return n;
+void Book::unmap() {
+    if (data) munmap(const_cast<unsigned char*>(data), mapping);
+    data = nullptr;
+    mapping = 0;
+    count = 0;
+    ranges.clear();
 }
 
 bool Book::load(const std::string& path) {
-    std::ifstream file(path, std::ios::binary);
-    if (!file) {
+    unmap();
+
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd == -1) {
         std::cout << "info string Book: file not found: " << path << std::endl;
         return false;
     }
 
-    BookEntry entry;
-    while (file.read(reinterpret_cast<char*>(&entry), sizeof(BookEntry))) {
-        entry.key = swap_uint64(entry.key);
-        entry.move = swap_uint16(entry.move);
-        entry.weight = swap_uint16(entry.weight);
-        entry.learn = swap_uint32(entry.learn);
-        entries.push_back(entry);
+    struct stat st;
+    if (fstat(fd, &st) == -1 || st.st_size < (off_t)ENTRY_SIZE) {
+        std::cout << "info string Book: empty or unreadable file: " << path << std::endl;
+        close(fd);
+        return false;
     }
 
-    std::cout << "info string Book: loaded " << entries.size() << " entries." << std::endl;
+    void* base = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        std::cout << "info string Book: could not map " << path << std::endl;
+        return false;
+    }
+    // Lookups jump around a binary search, so read-ahead only wastes I/O
+    madvise(base, st.st_size, MADV_RANDOM);
+
+    data = static_cast<const unsigned char*>(base);
+    mapping = st.st_size;
+    count = mapping / ENTRY_SIZE; // A trailing partial entry is ignored
+    ranges.assign(RANGE_SLOTS, RangeSlot{0, EMPTY_SLOT, 0});
+
+    std::cout << "info string Book: loaded " << count << " entries." << std::endl;
     return true;
 }
 
-Move Book::get_move(uint64_t hash) {
-    const BookEntry* best_entry = nullptr;
-    uint16_t max_weight = 0;
+Book::BookEntry Book::entry(size_t i) const {
+    const unsigned char* p = data + i * ENTRY_SIZE;
+    return {read_be<uint64_t>(p), read_be<uint16_t>(p + 8), read_be<uint16_t>(p + 10), read_be<uint32_t>(p + 12)};
+}
 
-    // Find all moves for the given hash and select the one with the highest weight that qualifies
-    for (const auto& entry : entries) {
-        if (entry.key == hash && entry.weight >= 10 && entry.learn >= 500 && entry.weight > max_weight) {
-            max_weight = entry.weight;
-            best_entry = &entry;
+uint64_t Book::key_at(size_t i) const {
+    return read_be<uint64_t>(data + i * ENTRY_SIZE);
+}
+
+// Index of the first entry whose key is not less than `key`
+size_t Book::lower_bound(uint64_t key) const {
+    size_t lo = 0, len = count;
+    while (len > 0) {
+        size_t half = len / 2;
+        if (key_at(lo + half) < key) {
+            lo += half + 1;
+            len -= half + 1;
+        } else {
+            len = half;
         }
     }
+    return lo;
+}
 
-    if (!best_entry) {
-        return Move(0);
+// Index slot for `key`, running the binary search on a miss
+const Book::RangeSlot& Book::find_range(uint64_t key) {
+    RangeSlot& slot = ranges[key & (RANGE_SLOTS - 1)];
+    if (slot.first != EMPTY_SLOT && slot.key == key) {
+        return slot;
     }
 
-    // Decode Polyglot move format
-    uint16_t poly_move = best_entry->move;
+    size_t first = lower_bound(key);
+    size_t last = first;
+    while (last < count && key_at(last) == key) ++last;
+    slot = {key, (uint32_t)first, (uint32_t)(last - first)};
+    return slot;
+}
+
+// Legal move of `pos` that a Polyglot move stands for, or Move(0)
+static Move decode_move(uint16_t poly_move, const Position& pos, const MoveList& legal_moves) {
     int from_file = (poly_move >> 6) & 7;
     int from_rank = (poly_move >> 9) & 7;
     int to_file = (poly_move >> 0) & 7;
@@ -78,14 +121,72 @@ Move Book::get_move(uint64_t hash) {
         }
     }
 
-    // We need the full position to create a valid move with all flags.
-    // The book does not store this information. For now, we create a simple move.
-    // This will fail for castling, en-passant, and captures.
-    // A full implementation would need to generate legal moves and match.
-    Move m;
-    m.set_from(from_sq);
-    m.set_to(to_sq);
-    m.set_promotion(promo_type);
+    // Polyglot writes castling as the king taking its own rook
+    PieceType king = pos.piece_on_square(from_sq);
+    if ((king == WK && from_sq == E1) || (king == BK && from_sq == E8)) {
+        if (to_file == 7) to_sq = static_cast<Square>(from_sq + 2);
+        if (to_file == 0) to_sq = static_cast<Square>(from_sq - 2);
+    }
 
-    return m;
+    // Match against the legal moves so the result carries the piece, capture
+    // and special-move flags that make_move needs
+    for (Move m : legal_moves) {
+        if (m.from() == from_sq && m.to() == to_sq && m.promotion() == promo_type) {
+            return m;
+        }
+    }
+    return Move(0);
+}
+
+std::vector<BookMove> Book::get_moves(const Position& pos) {
+    std::vector<BookMove> moves;
+    if (!is_loaded()) return moves;
+
+    const RangeSlot& range = find_range(pos.book_key);
+    if (range.count == 0) return moves;
+
+    MoveList legal_moves;
+    generate_legal_moves(pos, legal_moves);
+
+    uint32_t total = 0;
+    for (size_t i = range.first; i < range.first + range.count; ++i) {
+        BookEntry e = entry(i);
+        if (e.weight == 0) continue;
+        Move m = decode_move(e.move, pos, legal_moves);
+        if (m.value == 0) continue; // Not legal here: a key collision or a broken entry
+        moves.push_back({m, e.weight, 0.0});
+        total += e.weight;
+    }
+
+    for (BookMove& bm : moves) bm.probability = (double)bm.weight / total;
+    std::stable_sort(moves.begin(), moves.end(), [](const BookMove& a, const BookMove& b) {
+        return a.weight > b.weight;
+    });
+    return moves;
+}
+
+// SplitMix64 finalizer: spreads a seed and a position key over all 64 bits
+static uint64_t mix64(uint64_t z) {
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+Move Book::get_move(const Position& pos, uint64_t seed) {
+    std::vector<BookMove> moves = get_moves(pos);
+    if (moves.empty()) {
+        return Move(0);
+    }
+    if (seed == 0) {
+        return moves[0].move;
+    }
+
+    uint32_t total = 0;
+    for (const BookMove& bm : moves) total += bm.weight;
+    uint64_t r = mix64(seed + 0x9E3779B97F4A7C15ULL * pos.book_key) % total;
+    for (const BookMove& bm : moves) {
+        if (r < bm.weight) return bm.move;
+        r -= bm.weight;
+    }
+    return moves.back().move;
 }
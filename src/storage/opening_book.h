@@ -1,14 +1,43 @@
 #pragma once
 
 #include "types.h"
+#include <cstddef>
 #include <string>
 #include <vector>
 
+class Position;
+
+// A book move for a position with its share of the position's total weight
+struct BookMove {
+    Move move;
+    uint16_t weight;
+    double probability;
+};
+
+// Polyglot opening book. The file is mapped read-only and used in place:
+// entries are 16 big-endian bytes sorted by key, so a lookup is a binary
+// search that decodes only the entries it touches. The entry range found for
+// each key is remembered in a small direct-mapped index, so positions probed
+// again (the same openings in game after game) skip the search.
 class Book {
 public:
+    Book() = default;
+    ~Book();
+    Book(const Book&) = delete;
+    Book& operator=(const Book&) = delete;
+
     bool load(const std::string& path);
-    Move get_move(uint64_t hash);
-    bool is_loaded() const { return !entries.empty(); }
+
+    // Every book move for `pos` that is legal there, heaviest first, with
+    // probabilities summing to 1. Entries of weight 0 are never played.
+    std::vector<BookMove> get_moves(const Position& pos);
+
+    // Book move for `pos`, or Move(0) if the book has none. A seed of 0
+    // always picks the heaviest move; any other seed draws a move with
+    // probability proportional to its weight. The draw depends only on the
+    // seed and the position, so a seed replays the same opening line.
+    Move get_move(const Position& pos, uint64_t seed = 0);
+    bool is_loaded() const { return count > 0; }
 
 private:
     struct BookEntry {
@@ -17,5 +46,26 @@ private:
         uint16_t weight;
         uint32_t learn;
     };
-    std::vector<BookEntry> entries;
+    static const size_t ENTRY_SIZE = 16;
+
+    // Entries [first, first + count) hold `key`; first == EMPTY_SLOT marks an
+    // unused slot. Keys absent from the book are remembered with count 0.
+    struct RangeSlot {
+        uint64_t key;
+        uint32_t first;
+        uint32_t count;
+    };
+    static const uint32_t EMPTY_SLOT = ~0u;
+    static const size_t RANGE_SLOTS = 4096; // A power of two
+
+    BookEntry entry(size_t i) const;
+    uint64_t key_at(size_t i) const;
+    size_t lower_bound(uint64_t key) const;
+    const RangeSlot& find_range(uint64_t key);
+    void unmap();
+
+    const unsigned char* data = nullptr;
+    size_t mapping = 0;
+    size_t count = 0;
+    std::vector<RangeSlot> ranges;
 };
@@ -1,5 +1,6 @@
 #include "../src/engine/board.h"
 #include "../src/engine/movegen.h"
+#include "../src/engine/attack.h"
 #include <iostream>
 
 uint64_t perft(Position& pos, int depth) {
@@ -16,7 +17,9 @@ uint64_t perft(Position& pos, int depth) {
 }
 
 int main() {
-    Position pos;
+    init_attacks();
+    StateStack states;
+    Position pos(states);
     pos.set_from_fen("rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1");
     std::cout << "Perft 1: " << perft(pos, 1) << std::endl;
     // Add more depths